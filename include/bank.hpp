@@ -0,0 +1,82 @@
+/*
+    Nudelta Console
+    Copyright (C) 2022 Mohamed Gaber
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#ifndef _bank_hpp
+#define _bank_hpp
+
+#include "keymapfile.hpp"
+
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Many compiled profiles in one file, keyed by profile name and keyboard
+// model, so that switching between them costs a hash lookup in a mapped
+// file and the writes to the keyboard. The layout is little-endian:
+//
+//     0   magic "NDPB"
+//     4   u32 version
+//     8   u32 entry count
+//     12  u32 bucket count, a power of two
+//     16  u32 offset of the buckets
+//     20  u32 offset of the entries
+//     24  u64 reserved
+//
+// Each bucket is a u32: 0 if empty, otherwise an entry's index plus one.
+// Collisions are resolved by probing the following buckets. Each entry is
+// 24 bytes: the u64 FNV-1a hash of "<name>\0<model>", then u32 offsets and
+// sizes of the name and of the profile, which is stored as a keymap file.
+class ProfileBank {
+    public:
+        static const uint32_t VERSION = 1;
+
+        struct Entry {
+                std::string name;
+                CompiledProfile profile;
+        };
+        // Throws profile_bank_error if a name appears twice for one model.
+        static std::vector< uint8_t >
+        build(const std::vector< Entry > &entries);
+
+        // Throws profile_bank_error if the file is not a valid bank.
+        static std::shared_ptr< ProfileBank > open(const std::string &path);
+
+        // The named profile for this model, or nullptr if there is none.
+        std::shared_ptr< KeymapFile >
+        find(const std::string &name, const std::string &model) const;
+        // Every (name, model) pair in the bank, in the order they were added.
+        std::vector< std::pair< std::string, std::string > > list() const;
+        size_t size() const { return entryCount; }
+    private:
+        ProfileBank(std::shared_ptr< MappedFile > mapping);
+
+        std::shared_ptr< MappedFile > mapping;
+        uint32_t entryCount;
+        uint32_t bucketCount;
+        const uint8_t *buckets;
+        const uint8_t *entries;
+};
+
+class profile_bank_error : public std::runtime_error {
+    public:
+        profile_bank_error(const std::string &what)
+            : std::runtime_error(what) {}
+};
+
+#endif
@@ -0,0 +1,52 @@
+/*
+    Nudelta Console
+    Copyright (C) 2022 Mohamed Gaber
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#ifndef _bindings_hpp
+#define _bindings_hpp
+
+#include "nuphy.hpp"
+
+#include <string>
+#include <unordered_map>
+
+// Profiles bound to individual keyboards, loaded from a YAML file like:
+//
+//     serials:
+//       "6D8F1A2B": alice.yml
+//     paths:
+//       /dev/hidraw3: shared.yml
+//
+// Relative profile paths are resolved against the directory of the bindings
+// file. A keyboard's serial number takes precedence over its path.
+class ProfileBindings {
+    public:
+        struct Binding {
+                std::string profilePath;
+                std::string yaml; // Read once when the bindings are loaded
+        };
+
+        static ProfileBindings load(const std::string &path);
+
+        // The binding for this keyboard, or nullptr if there is none.
+        const Binding *find(const NuPhy &keyboard) const;
+        size_t size() const { return bySerial.size() + byPath.size(); }
+    private:
+        std::unordered_map< std::string, Binding > bySerial;
+        std::unordered_map< std::string, Binding > byPath;
+};
+
+#endif
@@ -30,6 +30,15 @@
 #include <vector>
 
 std::string to_utf8(std::wstring in);
+void initHID();
+// Renders bytes as a hex dump, one 32-bit word per line: its offset, then its
+// bytes. A word's non-empty entry in `annotations`, if any, ends its line.
+std::string formatBinary(
+    const uint8_t *data,
+    size_t size,
+    const std::vector< std::string > &annotations = {}
+);
+// Writes formatBinary(in) to `f` in a single call.
 void prettyPrintBinary(const std::vector< uint8_t > &in, FILE *f = stdout);
 
 #define p(...) fmt::print(__VA_ARGS__)
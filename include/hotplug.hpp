@@ -0,0 +1,64 @@
+/*
+    Nudelta Console
+    Copyright (C) 2022 Mohamed Gaber
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#ifndef _hotplug_hpp
+#define _hotplug_hpp
+
+#include "common.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+struct HotplugEvent {
+        bool attached;
+        std::string path; // Same format as HIDDeviceInfo::path
+};
+
+// Watches for NuPhy HID interfaces being attached or detached, calling
+// `callback` from a background thread until destroyed.
+//
+// On Linux, this listens to hidraw uevents over netlink (udev's, once it
+// has created the device node, if udev is running; the kernel's otherwise).
+// Elsewhere, it falls back to diffing the transport's enumeration once per
+// second.
+class HotplugMonitor {
+    public:
+        using Callback = std::function< void(const HotplugEvent &) >;
+
+        HotplugMonitor(Callback callback);
+        HotplugMonitor(const HotplugMonitor &) = delete;
+        HotplugMonitor &operator=(const HotplugMonitor &) = delete;
+        ~HotplugMonitor();
+    private:
+        void run();
+
+        Callback callback;
+        std::atomic< bool > running;
+#if defined(__gnu_linux__)
+        int stopPipe[2];
+        int socket;
+#else
+        std::mutex stopMutex;
+        std::condition_variable stopCondition;
+#endif
+        std::thread thread;
+};
+
+#endif
@@ -0,0 +1,100 @@
+/*
+    Nudelta Console
+    Copyright (C) 2022 Mohamed Gaber
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#ifndef _ipc_hpp
+#define _ipc_hpp
+
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// The protocol spoken between nudelta and nudeltad over a local Unix socket.
+//
+// Every message is one frame: a little-endian 32-bit payload length followed
+// by the payload. The payload is a sequence of fields, each again a
+// little-endian 32-bit length followed by that many bytes. Requests are a
+// command followed by its arguments, e.g. {"apply", <yaml>, "force"};
+// responses are "ok" or "error", a message to print, then any data.
+namespace IPC {
+    using Message = std::vector< std::string >;
+
+    // Frames larger than this are rejected rather than allocated.
+    static const uint32_t MAX_FRAME_SIZE = 16 * 1024 * 1024;
+
+    // $NUDELTA_SOCKET, or nudelta.sock under $XDG_RUNTIME_DIR, falling back
+    // to one in a private per-user directory under /tmp, which is created if
+    // needed. Throws ipc_error if that directory is not this user's alone.
+    std::string getDefaultSocketPath();
+
+    std::vector< uint8_t > encode(const Message &message);
+    // Decodes a frame's payload. Returns nullopt if it is malformed.
+    std::optional< Message > decode(const uint8_t *payload, size_t size);
+
+    // One end of an accepted or established connection. Closed on
+    // destruction.
+    class Connection {
+        public:
+            // Throws ipc_error if nothing is listening at `path`.
+            static std::unique_ptr< Connection >
+            connect(const std::string &path);
+
+            Connection(int fd) : fd(fd) {}
+            ~Connection();
+            Connection(const Connection &) = delete;
+            Connection &operator=(const Connection &) = delete;
+
+            void send(const Message &message);
+            // Returns nullopt once the other end has closed the connection.
+            std::optional< Message > receive();
+
+            // Sends `request` and waits for the response to it.
+            Message call(const Message &request);
+
+            // Makes a pending or later receive() return nullopt, as if the
+            // other end had closed the connection. Sending still works.
+            void interrupt();
+        private:
+            int fd;
+    };
+
+    // A listening socket, unlinked again on destruction. A stale socket
+    // left behind at `path` is replaced, but a live one is not.
+    class Listener {
+        public:
+            Listener(const std::string &path);
+            ~Listener();
+            Listener(const Listener &) = delete;
+            Listener &operator=(const Listener &) = delete;
+
+            // Waits at most `timeoutMs` for a client, returning nullptr on
+            // timeout or if interrupted by a signal.
+            std::unique_ptr< Connection > accept(int timeoutMs);
+        private:
+            std::string path;
+            int fd;
+    };
+}
+
+class ipc_error : public std::runtime_error {
+    public:
+        ipc_error(const std::string &what) : std::runtime_error(what) {}
+};
+
+#endif
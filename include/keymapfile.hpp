@@ -0,0 +1,106 @@
+/*
+    Nudelta Console
+    Copyright (C) 2022 Mohamed Gaber
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#ifndef _keymapfile_hpp
+#define _keymapfile_hpp
+
+#include "mapping.hpp"
+#include "profile.hpp"
+#include "report.hpp"
+
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Keymaps stored on disk: written by --dump-keys and --compile, read by
+// --load-keys, and used for profile cache entries. The layout is fixed and
+// little-endian throughout, so a file can be mapped and its keymaps sent to
+// a keyboard as they are:
+//
+//     0   magic "NDKM"
+//     4   u32 version
+//     8   u32 header size (64)
+//     12  u32 flags: 1 if the Windows keymap is present, 2 if the Mac one is
+//     16  model name, NUL-padded to 16 bytes
+//     32  u16 firmware (0 if unknown), u16 reserved
+//     36  u32 words per keymap
+//     40  u32 offset of the Windows keymap (0 if absent)
+//     44  u32 offset of the Mac keymap (0 if absent)
+//     48  u64 FNV-1a checksum of bytes [0, 48) and [64, end)
+//     56  u64 reserved
+//     64  keymaps, as little-endian 32-bit words
+//
+// Files without the magic are taken to be raw keymaps as dumped by earlier
+// versions: words for a single, unspecified mode and model.
+class KeymapFile {
+    public:
+        static const uint32_t VERSION = 1;
+        static const size_t HEADER_SIZE = 64;
+        static const size_t MAX_MODEL_SIZE = 16;
+
+        // Either keymap may be empty if that mode is absent; otherwise,
+        // both must be the same size.
+        static std::vector< uint8_t > encode(
+            const std::string &model,
+            uint16_t firmware,
+            Span< uint32_t > keymapWin,
+            Span< uint32_t > keymapMac
+        );
+        static std::vector< uint8_t > encode(const CompiledProfile &profile);
+
+        // Throws keymap_file_error if the file is neither a valid container
+        // nor a plausible raw keymap.
+        static std::shared_ptr< KeymapFile > open(const std::string &path);
+        static std::shared_ptr< KeymapFile >
+        fromBytes(std::vector< uint8_t > bytes);
+        // A keymap file embedded in a larger buffer, kept alive by `owner`.
+        static std::shared_ptr< KeymapFile >
+        view(Span< uint8_t > bytes, std::shared_ptr< const void > owner);
+
+        bool isRaw() const { return raw; }
+        const std::string &getModel() const { return model; } // Empty if raw
+        uint16_t getFirmware() const { return firmware; }
+        bool hasKeymap(bool mac) const {
+            return !(mac ? keymapMac : keymapWin).empty();
+        }
+        // A raw file's only keymap is returned for either mode. The view is
+        // valid as long as this is.
+        LE32View getKeymap(bool mac) const {
+            return mac ? keymapMac : keymapWin;
+        }
+
+        // Both modes decoded, for containers holding both.
+        CompiledProfile toProfile() const;
+    private:
+        KeymapFile(Span< uint8_t > bytes, std::shared_ptr< const void > owner);
+
+        std::shared_ptr< const void > owner; // Whatever holds the bytes
+
+        bool raw = false;
+        std::string model;
+        uint16_t firmware = 0;
+        LE32View keymapWin;
+        LE32View keymapMac;
+};
+
+class keymap_file_error : public std::runtime_error {
+    public:
+        keymap_file_error(const std::string &what) : std::runtime_error(what) {}
+};
+
+#endif
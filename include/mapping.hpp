@@ -0,0 +1,56 @@
+/*
+    Nudelta Console
+    Copyright (C) 2022 Mohamed Gaber
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#ifndef _mapping_hpp
+#define _mapping_hpp
+
+#include "table.hpp"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+// A whole file mapped read-only into memory. The mapping stays valid until
+// this is destroyed. On POSIX the file is closed as soon as it is mapped; on
+// Windows its handles are held until then.
+class MappedFile {
+    public:
+        // Throws std::runtime_error if the file cannot be opened or mapped.
+        // `sequential` hints that the file is read once, from start to end,
+        // so the OS reads ahead further and drops pages already read.
+        static std::unique_ptr< MappedFile >
+        open(const std::string &path, bool sequential = false);
+
+        MappedFile(const MappedFile &) = delete;
+        MappedFile &operator=(const MappedFile &) = delete;
+        ~MappedFile();
+
+        const uint8_t *data() const { return start; }
+        size_t size() const { return length; }
+        Span< uint8_t > bytes() const { return Span< uint8_t >(start, length); }
+    private:
+        MappedFile() = default;
+
+        const uint8_t *start = nullptr;
+        size_t length = 0;
+#if defined(_WIN32)
+        void *file = nullptr;
+        void *mapping = nullptr;
+#endif
+};
+
+#endif
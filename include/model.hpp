@@ -0,0 +1,72 @@
+/*
+    Nudelta Console
+    Copyright (C) 2022 Mohamed Gaber
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#ifndef _model_hpp
+#define _model_hpp
+
+#include "table.hpp"
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Everything that tells one keyboard model apart from another. Models are
+// plain data, generated by util/res_to_cpp.js from res/<model>/model.yml
+// and the resource tables next to it, or decoded from a model pack.
+struct ModelDescriptor {
+        struct Mode {
+                // Requests the mode's keymap region
+                Span< uint8_t > getKeymapHeader;
+                // Precedes the keymap when writing it
+                Span< uint8_t > setKeymapHeader;
+                Span< uint32_t > defaultKeymap;
+                NameTable indicesByKeyName;
+        };
+
+        std::string_view name; // e.g. "Air75"
+        // As reported over USB, without the manufacturer
+        std::string_view productString;
+        size_t keymapSize; // In words, for either mode
+        Mode win;
+        Mode mac;
+
+        const Mode &getMode(bool mac) const {
+            return mac ? this->mac : this->win;
+        }
+
+        // The models compiled into the binary, if any: see
+        // NUDELTA_BUILTIN_MODELS in CMakeLists.txt.
+        static const Span< ModelDescriptor > builtIn;
+};
+
+// Lookups over every known model: those in model packs (see modelpack.hpp)
+// found in the directories of $NUDELTA_MODEL_PATH, separated as in $PATH,
+// then in the NUDELTA_MODEL_DIR set at build time, and those built into the
+// binary, which a pack for the same model takes precedence over.
+//
+// Only the packs' headers are read up front: a pack is decoded once its model
+// is looked up. Both lookups are hash map lookups and return nullptr for
+// unknown models. A pack found to be invalid is skipped with a warning, in
+// favor of the built-in model if there is one.
+namespace ModelRegistry {
+    const ModelDescriptor *findByProductString(std::string_view productString);
+    const ModelDescriptor *findByName(std::string_view name);
+    // Every known model's name, without decoding any pack
+    std::vector< std::string > getNames();
+}
+
+#endif
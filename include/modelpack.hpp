@@ -0,0 +1,90 @@
+/*
+    Nudelta Console
+    Copyright (C) 2022 Mohamed Gaber
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#ifndef _modelpack_hpp
+#define _modelpack_hpp
+
+#include "mapping.hpp"
+#include "model.hpp"
+
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// A keyboard model stored outside the binary, as written by
+// util/res_to_pack.js, so that models can be added without rebuilding. Only
+// the header is read when a pack is opened; the tables are decoded when the
+// model is first used. The layout is little-endian:
+//
+//     0   magic "NDMP"
+//     4   u32 version
+//     8   u32 header size (64)
+//     12  u32 words per keymap
+//     16  model name, NUL-padded to 16 bytes
+//     32  u32 offset and u32 size of the product string
+//     40  u32 offset of the Windows mode, u32 offset of the Mac mode
+//     48  u64 FNV-1a checksum of bytes [0, 48) and [64, end)
+//     56  u64 reserved
+//     64  the product string, then the modes and their tables
+//
+// Each mode is 32 bytes: u32 offsets and sizes of the get and the set keymap
+// report headers, the u32 offset of the default keymap, the u32 offset and
+// count of the index table, then a reserved u32. Each index table entry is
+// 12 bytes: the u32 offset and size of a key's name, then its u32 index.
+class ModelPack {
+    public:
+        static const uint32_t VERSION = 1;
+        static const size_t HEADER_SIZE = 64;
+        static const size_t MAX_MODEL_SIZE = 16;
+
+        // Throws model_pack_error if the header is not valid.
+        static std::shared_ptr< ModelPack > open(const std::string &path);
+
+        const std::string &getPath() const { return path; }
+        const std::string &getName() const { return name; }
+        const std::string &getProductString() const { return productString; }
+
+        // Decodes the tables on first use. Throws model_pack_error if any of
+        // them is invalid, or if the file is corrupt.
+        const ModelDescriptor &getDescriptor();
+    private:
+        ModelPack(
+            const std::string &path,
+            std::shared_ptr< MappedFile > mapping
+        );
+        void decode();
+
+        std::string path;
+        std::shared_ptr< MappedFile > mapping;
+        std::string name;
+        std::string productString;
+
+        std::mutex mutex;
+        std::optional< ModelDescriptor > descriptor;
+        std::vector< uint32_t > defaultKeymaps[2];
+        std::vector< NameTable::Entry > indicesByKeyName[2];
+};
+
+class model_pack_error : public std::runtime_error {
+    public:
+        model_pack_error(const std::string &what) : std::runtime_error(what) {}
+};
+
+#endif
@@ -18,9 +18,13 @@
 #ifndef _nuphy_hpp
 #define _nuphy_hpp
 #include "common.hpp"
+#include "model.hpp"
+#include "profile.hpp"
+#include "report.hpp"
+#include "table.hpp"
+#include "transport.hpp"
 
 #include <functional>
-#include <hidapi.h>
 #include <locale>
 #include <memory>
 #include <optional>
@@ -28,144 +32,208 @@
 #include <unordered_map>
 #include <vector>
 
-class NuPhy { // Abstract
+class ProfileBank;
+namespace YAML {
+    class Node;
+}
+
+class NuPhy {
     public:
+        const ModelDescriptor &model;
         std::string dataPath;
         std::string requestPath;
         uint16_t firmware;
+        // As reported by the keyboard, if it reports one at all
+        std::optional< std::string > serialNumber;
+
+        NuPhy(
+            const ModelDescriptor &model,
+            std::string dataPath,
+            std::string requestPath,
+            uint16_t firmware
+        )
+            : model(model), dataPath(dataPath), requestPath(requestPath),
+              firmware(firmware) {}
+
+        // An open connection to the keyboard. Any number of reports may be
+        // exchanged over one session; the handles are closed on destruction.
+        class Session {
+            public:
+                std::shared_ptr< HIDDevice > data;
+                std::shared_ptr< HIDDevice >
+                    request; // Same on macOS/Linux - different on Windows
+                std::string dataPath;
+                std::string requestPath;
+                // Holds the last report sent or received
+                ReportBuffer report;
+
+                Session(
+                    const std::string &dataPath,
+                    const std::string &requestPath
+                );
+                Session(const Session &) = delete;
+                Session &operator=(const Session &) = delete;
+        };
+        std::shared_ptr< Session > openSession();
 
-        NuPhy(std::string dataPath, std::string requestPath, uint16_t firmware)
-            : dataPath(dataPath), requestPath(requestPath), firmware(firmware) {
-        }
+        // Methods taking a session use it if passed, otherwise they open
+        // (and close) one of their own.
+        std::vector< uint32_t > getKeymap(
+            bool mac = false,
+            std::shared_ptr< Session > session = nullptr
+        );
+        // With `verify` set, the mode is read back over the same session
+        // after writing. Mismatching writes are retried with a bounded
+        // backoff, after which a write_verification_error is thrown.
+        void setKeymap(
+            Span< uint32_t > keymap,
+            bool mac = false,
+            std::shared_ptr< Session > session = nullptr,
+            bool verify = false
+        );
 
-        std::vector< uint32_t > getKeymap(bool mac = false);
-        void setKeymap(const std::vector< uint32_t > &keymap, bool mac = false);
-        void setKeymapFromYAML(const std::string &yamlString);
-        void resetKeymap();
+        // Reads a keymap without copying it out of the session's report
+        // buffer. The view is valid until the session's next report.
+        LE32View readKeymap(bool mac, Session &session);
 
-        virtual std::string getName() = 0;
-        virtual std::vector< uint32_t > getDefaultKeymap(bool mac = false) = 0;
-        virtual std::unordered_map< std::string, uint32_t >
-        getIndicesByKeyName(bool mac = false) = 0;
+        // The outcome of applying a keymap to one of the keyboard's modes.
+        struct KeymapDiff {
+                bool mac;
+                std::vector< size_t > changedIndices;
+                bool written;
+                bool verified; // Read back after writing and found identical
+        };
+        // One line summing up what applying a keymap did to each mode.
+        static std::string
+        describeDiffs(const std::vector< KeymapDiff > &diffs);
+        // For each word of one of this model's keymaps, e.g. as read back,
+        // the key it belongs to and the keycode it holds, as in "esc -> grave"
+        // or "rctrl -> ctrl+shift+c". Whichever cannot be told is left out.
+        std::vector< std::string >
+        annotateKeymap(Span< uint32_t > keymap, bool mac = false);
+
+        // Reads the mode's current keymap back first and only writes
+        // `keymap` if any word differs, unless `force` is set.
+        KeymapDiff applyKeymap(
+            Span< uint32_t > keymap,
+            bool mac = false,
+            std::shared_ptr< Session > session = nullptr,
+            bool force = false,
+            bool verify = false
+        );
 
-        virtual std::unordered_map< std::string, uint32_t >
-        getKeycodesByKeyName() {
-            return keycodesByKeyName;
+        // Validates the profile and resolves it against this model. Unless
+        // `useCache` is unset, the result is looked up in and stored to the
+        // profile cache, in which case YAML is not parsed at all on a hit.
+        CompiledProfile
+        compileYAMLKeymap(const std::string &yamlString, bool useCache = true);
+        std::vector< KeymapDiff > setKeymapFromProfile(
+            const CompiledProfile &profile,
+            std::shared_ptr< Session > session = nullptr,
+            bool force = false,
+            bool verify = false
+        );
+        // Throws if the bank holds no profile by that name for this model.
+        std::vector< KeymapDiff > setKeymapFromBank(
+            const ProfileBank &bank,
+            const std::string &name,
+            std::shared_ptr< Session > session = nullptr,
+            bool force = false,
+            bool verify = false
+        );
+        std::vector< KeymapDiff > setKeymapFromYAML(
+            const std::string &yamlString,
+            std::shared_ptr< Session > session = nullptr,
+            bool force = false,
+            bool verify = false
+        );
+        std::vector< KeymapDiff > resetKeymap(
+            std::shared_ptr< Session > session = nullptr,
+            bool force = false,
+            bool verify = false
+        );
+
+        std::string getName() { return std::string(model.name); }
+        std::string getProductString() {
+            return std::string(model.productString);
+        }
+        Span< uint32_t > getDefaultKeymap(bool mac = false) {
+            return model.getMode(mac).defaultKeymap;
         }
-        virtual std::unordered_map< std::string, uint32_t >
-        getModifiersByModifierName() {
+        const NameTable &getIndicesByKeyName(bool mac = false) {
+            return model.getMode(mac).indicesByKeyName;
+        }
+
+        const NameTable &getKeycodesByKeyName() { return keycodesByKeyName; }
+        const NameTable &getModifiersByModifierName() {
             return modifiersByModifierName;
         }
 
-        virtual std::vector< uint8_t >
-        getKeymapReportHeader(bool mac = false) = 0;
-        virtual std::vector< uint8_t >
-        setKeymapReportHeader(bool mac = false) = 0;
+        Span< uint8_t > getKeymapReportHeader(bool mac = false) {
+            return model.getMode(mac).getKeymapHeader;
+        }
+        Span< uint8_t > setKeymapReportHeader(bool mac = false) {
+            return model.getMode(mac).setKeymapHeader;
+        }
 
         static std::shared_ptr< NuPhy >
         find(bool verify = true); // Factory Method
+        static std::vector< std::shared_ptr< NuPhy > >
+        findAll(bool verify = true);
+        // A keyboard of the given model (e.g. "Air75"), whether or not one
+        // is connected. Throws unsupported_keyboard for unknown models.
+        static std::shared_ptr< NuPhy > forModel(
+            const std::string &model,
+            std::string dataPath = "",
+            std::string requestPath = "",
+            uint16_t firmware = 0
+        );
 
+        // A problem found in a YAML profile. `line` and `column` are
+        // 1-based, or 0 if it cannot be traced back to the source.
+        struct Diagnostic {
+                std::string message;
+                int line;
+                int column;
+        };
+
+        // Throws the first problem found in one mode of the profile.
         void validateYAMLKeymap(
             const std::string &yamlString,
             bool rawOk = true,
             bool mac = false
         );
-        struct Handles {
-                hid_device *data;
-                hid_device
-                    *request; // Same on macOS/Linux - different on Windows
-                std::string dataPath;
-                std::string requestPath;
-                std::function< void(NuPhy::Handles &) > cleanup;
-        };
-    private:
-        Handles getHandles();
-
-        static const std::unordered_map< std::string, uint32_t >
-            keycodesByKeyName;
-        static const std::unordered_map< std::string, uint32_t >
-            modifiersByModifierName;
-};
-
-class Air75 : public NuPhy {
-    public:
-        Air75(std::string dataPath, std::string requestPath, uint16_t firmware)
-            : NuPhy(dataPath, requestPath, firmware) {}
+        // Returns every problem found in either mode of the profile.
+        std::vector< Diagnostic >
+        diagnoseYAMLKeymap(const std::string &yamlString, bool rawOk = true);
+        // Appends every problem found in one entry of a mode's map, i.e.
+        // `key: codeObject`, to `diagnostics`.
+        void validateYAMLEntry(
+            const YAML::Node &key,
+            const YAML::Node &codeObject,
+            bool rawOk,
+            bool mac,
+            std::vector< Diagnostic > &diagnostics
+        );
 
-        virtual std::string getName() { return "Air75"; }
-        virtual std::vector< uint32_t > getDefaultKeymap(bool mac = false) {
-            return mac ? Air75::defaultKeymapMac : Air75::defaultKeymapWin;
-        }
-        virtual std::unordered_map< std::string, uint32_t >
-        getIndicesByKeyName(bool mac = false) {
-            return mac ? Air75::indicesByKeyNameMac :
-                         Air75::indicesByKeyNameWin;
-        }
-        virtual std::vector< uint8_t > getKeymapReportHeader(bool mac = false) {
-            return mac ? std::vector< uint8_t >(
-                       {0x05, 0x84, 0xd4, 0x00, 0x00, 0x00}
-                   ) :
-                         std::vector< uint8_t >(
-                             {0x05, 0x84, 0xd8, 0x00, 0x00, 0x00}
-                         );
-        }
-        virtual std::vector< uint8_t > setKeymapReportHeader(bool mac = false) {
-            return mac ? std::vector< uint8_t >(
-                       {0x06, 0x04, 0xd4, 0x00, 0x40, 0x00, 0x00, 0x00}
-                   ) :
-                         std::vector< uint8_t >(
-                             {0x06, 0x04, 0xd8, 0x00, 0x40, 0x00, 0x00, 0x00}
-                         );
-        }
-    private:
-        static const std::vector< uint32_t > defaultKeymapWin;
-        static const std::unordered_map< std::string, uint32_t >
-            indicesByKeyNameWin;
-
-        static const std::vector< uint32_t > defaultKeymapMac;
-        static const std::unordered_map< std::string, uint32_t >
-            indicesByKeyNameMac;
+        // Shared by every model
+        static const NameTable keycodesByKeyName;
+        static const NameTable modifiersByModifierName;
 };
 
-class Halo75 : public NuPhy {
+// Thrown when a mode still does not read back as written after every retry.
+class write_verification_error : public std::runtime_error {
     public:
-        Halo75(std::string dataPath, std::string requestPath, uint16_t firmware)
-            : NuPhy(dataPath, requestPath, firmware) {}
-
-        virtual std::string getName() { return "Halo75"; }
-        virtual std::vector< uint32_t > getDefaultKeymap(bool mac = false) {
-            return mac ? Halo75::defaultKeymapMac : Halo75::defaultKeymapWin;
-        }
-        virtual std::unordered_map< std::string, uint32_t >
-        getIndicesByKeyName(bool mac = false) {
-            return mac ? Halo75::indicesByKeyNameMac :
-                         Halo75::indicesByKeyNameWin;
-        }
-
-        virtual std::vector< uint8_t > getKeymapReportHeader(bool mac = false) {
-            return mac ? std::vector< uint8_t >(
-                       {0x05, 0x84, 0xd8, 0x00, 0x00, 0x00}
-                   ) :
-                         std::vector< uint8_t >(
-                             {0x05, 0x84, 0xd4, 0x00, 0x00, 0x00}
-                         );
-        }
-        virtual std::vector< uint8_t > setKeymapReportHeader(bool mac = false) {
-            return mac ? std::vector< uint8_t >(
-                       {0x06, 0x04, 0xd8, 0x00, 0x40, 0x00, 0x00, 0x00}
-                   ) :
-                         std::vector< uint8_t >(
-                             {0x06, 0x04, 0xd4, 0x00, 0x40, 0x00, 0x00, 0x00}
-                         );
-        }
-    private:
-        static const std::vector< uint32_t > defaultKeymapWin;
-        static const std::unordered_map< std::string, uint32_t >
-            indicesByKeyNameWin;
-
-        static const std::vector< uint32_t > defaultKeymapMac;
-        static const std::unordered_map< std::string, uint32_t >
-            indicesByKeyNameMac;
+        bool mac;
+        std::vector< size_t > mismatchedIndices;
+
+        write_verification_error(
+            const std::string &what,
+            bool mac,
+            std::vector< size_t > mismatchedIndices
+        )
+            : std::runtime_error(what), mac(mac),
+              mismatchedIndices(mismatchedIndices) {}
 };
 
 class unsupported_keyboard : public std::runtime_error {
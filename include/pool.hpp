@@ -0,0 +1,33 @@
+/*
+    Nudelta Console
+    Copyright (C) 2022 Mohamed Gaber
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#ifndef _pool_hpp
+#define _pool_hpp
+
+#include <cstddef>
+#include <functional>
+
+// Runs `job(i)` for every i in [0, count) on at most `maxWorkers` threads
+// (0: one per hardware thread). Blocks until every job has finished. If any
+// job throws, the first exception is rethrown once all workers have joined.
+void parallelFor(
+    size_t count,
+    const std::function< void(size_t) > &job,
+    size_t maxWorkers = 0
+);
+
+#endif
@@ -0,0 +1,53 @@
+/*
+    Nudelta Console
+    Copyright (C) 2022 Mohamed Gaber
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#ifndef _profile_hpp
+#define _profile_hpp
+
+#include "common.hpp"
+
+// A YAML profile resolved against one keyboard model: both modes' keymaps,
+// ready to be written as-is.
+struct CompiledProfile {
+        std::string model;
+        std::vector< uint32_t > keymapWin;
+        std::vector< uint32_t > keymapMac;
+
+        const std::vector< uint32_t > &getKeymap(bool mac = false) const {
+            return mac ? keymapMac : keymapWin;
+        }
+};
+
+static const uint64_t FNV1A64_OFFSET_BASIS = 0xcbf29ce484222325;
+uint64_t fnv1a64(
+    const void *data,
+    size_t size,
+    uint64_t hash = FNV1A64_OFFSET_BASIS
+);
+
+// The on-disk profile cache. Entries are keymap files (see keymapfile.hpp)
+// keyed by a hash of the profile's source and everything it was resolved
+// against. Failing to read or write the cache is never an error: the
+// profile is just compiled again.
+namespace ProfileCache {
+    // $NUDELTA_CACHE_DIR, or the platform's per-user cache directory.
+    std::optional< std::string > getDirectory();
+    std::optional< CompiledProfile > load(uint64_t key);
+    void store(uint64_t key, const CompiledProfile &profile);
+}
+
+#endif
@@ -0,0 +1,40 @@
+/*
+    Nudelta Console
+    Copyright (C) 2022 Mohamed Gaber
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#ifndef _registry_hpp
+#define _registry_hpp
+
+#include "nuphy.hpp"
+
+// A process-wide cache in front of NuPhy::findAll, so long-running hosts
+// enumerate once instead of on every operation.
+//
+// The cache is dropped whenever a cached keyboard fails to open, and on
+// every hotplug event once watchHotplug() has been called. Only then are
+// empty results cached as well, as nothing else would notice a keyboard
+// being plugged in.
+namespace DeviceRegistry {
+    std::vector< std::shared_ptr< NuPhy > > getAll();
+    std::shared_ptr< NuPhy > get(); // First keyboard or nullptr
+    void invalidate();
+    void watchHotplug();
+    // Stops watching, joining the monitor thread. Runs on exit before
+    // hid_exit does, as the monitor may be enumerating devices.
+    void stopHotplug();
+}
+
+#endif
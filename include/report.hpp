@@ -0,0 +1,124 @@
+/*
+    Nudelta Console
+    Copyright (C) 2022 Mohamed Gaber
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#ifndef _report_hpp
+#define _report_hpp
+
+#include "table.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <vector>
+
+// Keymaps are sent and received as little-endian 32-bit words, regardless of
+// the host's byte order. Compilers reduce these to a single load or store on
+// little-endian hosts.
+inline uint32_t readLE32(const uint8_t *bytes) {
+    return uint32_t(bytes[0]) | (uint32_t(bytes[1]) << 8)
+        | (uint32_t(bytes[2]) << 16) | (uint32_t(bytes[3]) << 24);
+}
+
+inline void writeLE32(uint8_t *bytes, uint32_t value) {
+    bytes[0] = uint8_t(value);
+    bytes[1] = uint8_t(value >> 8);
+    bytes[2] = uint8_t(value >> 16);
+    bytes[3] = uint8_t(value >> 24);
+}
+
+// A read-only view of little-endian 32-bit words stored as bytes, e.g. a
+// keymap inside a report, decoded one word at a time as it is accessed.
+class LE32View {
+    public:
+        class iterator {
+            public:
+                using iterator_category = std::input_iterator_tag;
+                using value_type = uint32_t;
+                using difference_type = std::ptrdiff_t;
+                using pointer = const uint32_t *;
+                using reference = uint32_t;
+
+                iterator(const uint8_t *position) : position(position) {}
+                uint32_t operator*() const { return readLE32(position); }
+                iterator &operator++() {
+                    position += 4;
+                    return *this;
+                }
+                bool operator==(const iterator &other) const {
+                    return position == other.position;
+                }
+                bool operator!=(const iterator &other) const {
+                    return position != other.position;
+                }
+            private:
+                const uint8_t *position;
+        };
+
+        LE32View() : start(nullptr), count(0) {}
+        LE32View(const uint8_t *start, size_t count)
+            : start(start), count(count) {}
+
+        iterator begin() const { return iterator(start); }
+        iterator end() const { return iterator(start + count * 4); }
+        size_t size() const { return count; }
+        bool empty() const { return count == 0; }
+        uint32_t operator[](size_t i) const { return readLE32(start + i * 4); }
+
+        // The undecoded words, i.e. exactly as they are sent over the wire.
+        Span< uint8_t > bytes() const {
+            return Span< uint8_t >(start, count * 4);
+        }
+
+        std::vector< uint32_t > toVector() const {
+            std::vector< uint32_t > words(count);
+            for (size_t i = 0; i < count; i += 1) {
+                words[i] = (*this)[i];
+            }
+            return words;
+        }
+    private:
+        const uint8_t *start;
+        size_t count;
+};
+
+// The largest feature report read from or written to a keyboard.
+static const size_t MAX_REPORT_SIZE = 0x7FF;
+
+// A fixed-size buffer for one feature report, reused across every report
+// sent or received through the same session so that neither allocates.
+// Aligned so the words following a report's header are as well.
+class ReportBuffer {
+    public:
+        uint8_t *data() { return bytes; }
+        const uint8_t *data() const { return bytes; }
+        size_t size() const { return used; }
+        constexpr size_t capacity() const { return MAX_REPORT_SIZE; }
+        void resize(size_t size) { used = size; }
+
+        // The whole little-endian words stored at and after `offset`.
+        LE32View words(size_t offset) const {
+            if (used < offset) {
+                return LE32View();
+            }
+            return LE32View(bytes + offset, (used - offset) / 4);
+        }
+    private:
+        alignas(8) uint8_t bytes[MAX_REPORT_SIZE];
+        size_t used = 0;
+};
+
+#endif
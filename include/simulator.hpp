@@ -0,0 +1,63 @@
+/*
+    Nudelta Console
+    Copyright (C) 2022 Mohamed Gaber
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#ifndef _simulator_hpp
+#define _simulator_hpp
+
+#include "transport.hpp"
+
+#include <chrono>
+#include <map>
+#include <mutex>
+
+// An in-process stand-in for one or more NuPhy keyboards, speaking the
+// feature report protocol documented in util/usb/docs.md. Keymaps start out
+// as the model's defaults and persist for the lifetime of the transport.
+class SimulatedTransport : public HIDTransport {
+    public:
+        struct Keyboard;
+
+        // `latency` is added to every feature report sent or received.
+        SimulatedTransport(
+            std::chrono::microseconds latency = std::chrono::microseconds(0)
+        );
+
+        // Returns the path the keyboard's interface is enumerated at (the
+        // request interface's, on Windows.)
+        std::string addKeyboard(const std::string &model);
+        void removeKeyboard(const std::string &path);
+        // The keyboard's next `count` keymap writes are acknowledged, but
+        // not stored, e.g. to exercise verified writes.
+        void dropWrites(const std::string &path, size_t count);
+
+        virtual std::vector< HIDDeviceInfo >
+        enumerate(uint16_t vendorID, uint16_t productID);
+        virtual std::unique_ptr< HIDDevice > open(const std::string &path);
+
+        // Configured by $NUDELTA_SIMULATE, a comma-separated list of models
+        // (e.g. "Air75,Halo75"), $NUDELTA_SIMULATE_LATENCY_US and
+        // $NUDELTA_SIMULATE_DROPPED_WRITES (per keyboard). Returns nullptr if
+        // $NUDELTA_SIMULATE is unset or empty.
+        static std::shared_ptr< SimulatedTransport > fromEnvironment();
+    private:
+        std::chrono::microseconds latency;
+        std::mutex mutex;
+        size_t counter = 0;
+        std::map< std::string, std::shared_ptr< Keyboard > > keyboards;
+};
+
+#endif
@@ -0,0 +1,113 @@
+/*
+    Nudelta Console
+    Copyright (C) 2022 Mohamed Gaber
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#ifndef _stats_hpp
+#define _stats_hpp
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Cumulative, process-wide counters and latency histograms. Always collected;
+// every update is a handful of relaxed atomic operations, so any thread may
+// record or read them at any time without locking.
+namespace Stats {
+    class Histogram {
+        public:
+            // Bucket 0 holds durations under 1µs, bucket i durations in
+            // [2^(i - 1), 2^i) µs, and the last bucket everything longer.
+            static const size_t BUCKETS = 32;
+
+            struct Snapshot {
+                    uint64_t count;
+                    uint64_t totalNanoseconds;
+                    uint64_t maxNanoseconds;
+                    std::array< uint64_t, BUCKETS > buckets;
+
+                    double meanMicroseconds() const;
+                    // An upper bound, accurate to the bucket (a factor of 2)
+                    double percentileMicroseconds(double percentile) const;
+            };
+
+            void record(std::chrono::nanoseconds duration);
+            Snapshot snapshot() const;
+        private:
+            std::atomic< uint64_t > count = 0;
+            std::atomic< uint64_t > totalNanoseconds = 0;
+            std::atomic< uint64_t > maxNanoseconds = 0;
+            std::array< std::atomic< uint64_t >, BUCKETS > buckets = {};
+    };
+
+    // Records the duration of the enclosing scope to a histogram.
+    class Timer {
+        public:
+            Timer(Histogram &histogram)
+                : histogram(histogram),
+                  start(std::chrono::steady_clock::now()) {}
+            Timer(const Timer &) = delete;
+            Timer &operator=(const Timer &) = delete;
+            ~Timer() {
+                histogram.record(std::chrono::steady_clock::now() - start);
+            }
+        private:
+            Histogram &histogram;
+            std::chrono::steady_clock::time_point start;
+    };
+
+    struct Metrics {
+            std::atomic< uint64_t > enumerations = 0;
+            std::atomic< uint64_t > opens = 0;
+            std::atomic< uint64_t > openFailures = 0;
+            std::atomic< uint64_t > reportsSent = 0;
+            std::atomic< uint64_t > reportsReceived = 0;
+            std::atomic< uint64_t > bytesWritten = 0;
+            std::atomic< uint64_t > bytesRead = 0;
+            std::atomic< uint64_t > reportFailures = 0;
+            std::atomic< uint64_t > writeRetries = 0;
+            std::atomic< uint64_t > verificationFailures = 0;
+            std::atomic< uint64_t > profilesCompiled = 0;
+            std::atomic< uint64_t > cacheHits = 0;
+            std::atomic< uint64_t > cacheMisses = 0;
+
+            Histogram enumerateLatency;
+            Histogram openLatency;
+            Histogram sendLatency;
+            Histogram receiveLatency;
+            Histogram parseLatency;
+            Histogram compileLatency;
+    };
+
+    Metrics &get();
+
+    struct Snapshot {
+            std::vector< std::pair< std::string, uint64_t > > counters;
+            std::vector< std::pair< std::string, Histogram::Snapshot > >
+                histograms;
+    };
+
+    // Every metric by name, for printing or exporting.
+    Snapshot snapshot();
+
+    // A human-readable table of snapshot().
+    std::string format();
+}
+
+#endif
@@ -0,0 +1,85 @@
+/*
+    Nudelta Console
+    Copyright (C) 2022 Mohamed Gaber
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#ifndef _table_hpp
+#define _table_hpp
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// A read-only view over a contiguous array, e.g. a generated resource table.
+template < typename T >
+class Span {
+    public:
+        constexpr Span() : start(nullptr), count(0) {}
+        constexpr Span(const T *start, size_t count)
+            : start(start), count(count) {}
+        template < size_t N >
+        constexpr Span(const T (&array)[N]) : start(array), count(N) {}
+        Span(const std::vector< T > &vector)
+            : start(vector.data()), count(vector.size()) {}
+
+        constexpr const T *begin() const { return start; }
+        constexpr const T *end() const { return start + count; }
+        constexpr const T *data() const { return start; }
+        constexpr size_t size() const { return count; }
+        constexpr bool empty() const { return count == 0; }
+        constexpr const T &operator[](size_t i) const { return start[i]; }
+    private:
+        const T *start;
+        size_t count;
+};
+
+// A read-only name -> value table over an array sorted by name, as generated
+// by util/res_to_cpp.js. Lookups are binary searches and never allocate.
+class NameTable {
+    public:
+        using Entry = std::pair< std::string_view, uint32_t >;
+
+        constexpr NameTable() : entries() {}
+        constexpr NameTable(Span< Entry > entries) : entries(entries) {}
+        template < size_t N >
+        constexpr NameTable(const Entry (&array)[N]) : entries(array) {}
+
+        const Entry *begin() const { return entries.begin(); }
+        const Entry *end() const { return entries.end(); }
+        size_t size() const { return entries.size(); }
+
+        // Returns end() if `name` is not in the table.
+        const Entry *find(std::string_view name) const {
+            auto it = std::lower_bound(
+                begin(),
+                end(),
+                name,
+                [](const Entry &entry, std::string_view name) {
+                    return entry.first < name;
+                }
+            );
+            if (it == end() || it->first != name) {
+                return end();
+            }
+            return it;
+        }
+    private:
+        Span< Entry > entries;
+};
+
+#endif
@@ -0,0 +1,65 @@
+/*
+    Nudelta Console
+    Copyright (C) 2022 Mohamed Gaber
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#ifndef _trace_hpp
+#define _trace_hpp
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <string_view>
+
+// Timing spans recorded in memory and written out in the Chrome trace event
+// format, which chrome://tracing and ui.perfetto.dev can open. Disabled by
+// default, in which case a span costs a single relaxed atomic load.
+namespace Trace {
+    extern std::atomic< bool > enabled;
+
+    inline bool isEnabled() {
+        return enabled.load(std::memory_order_relaxed);
+    }
+
+    void enable();
+
+    // Writes every span recorded so far to `path`.
+    void write(const std::string &path);
+
+    // Times the enclosing scope. Spans with a `track` (e.g. a device path)
+    // are drawn on a row of their own, so every device's I/O can be told
+    // apart; the rest are drawn on the row of the thread that recorded them.
+    class Span {
+        public:
+            Span(
+                const char *name,
+                const char *category,
+                std::string_view track = {},
+                std::string_view detail = {}
+            );
+            Span(const Span &) = delete;
+            Span &operator=(const Span &) = delete;
+            ~Span();
+        private:
+            const char *name;
+            const char *category;
+            std::string track;
+            std::string detail;
+            bool recording;
+            std::chrono::steady_clock::time_point start;
+    };
+}
+
+#endif
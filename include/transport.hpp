@@ -0,0 +1,71 @@
+/*
+    Nudelta Console
+    Copyright (C) 2022 Mohamed Gaber
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#ifndef _transport_hpp
+#define _transport_hpp
+
+#include "common.hpp"
+
+#include <memory>
+
+// The subset of hid_device_info that NuPhy uses, already converted to UTF-8.
+struct HIDDeviceInfo {
+        std::string path;
+        uint16_t vendorID;
+        uint16_t productID;
+        std::optional< std::string > serialNumber;
+        uint16_t releaseNumber;
+        std::optional< std::string > manufacturerString;
+        std::optional< std::string > productString;
+        uint16_t usagePage;
+        uint16_t usage;
+        int interfaceNumber;
+};
+
+// An open HID interface. Return values follow hidapi: the number of bytes
+// transferred, or -1 on failure, in which case getError() describes why.
+class HIDDevice {
+    public:
+        virtual ~HIDDevice() = default;
+        virtual int sendFeatureReport(const uint8_t *data, size_t size) = 0;
+        virtual int getFeatureReport(uint8_t *data, size_t size) = 0;
+        virtual std::string getError() = 0;
+};
+
+class HIDTransport {
+    public:
+        virtual ~HIDTransport() = default;
+        virtual std::vector< HIDDeviceInfo >
+        enumerate(uint16_t vendorID, uint16_t productID) = 0;
+        // Returns nullptr if the device could not be opened.
+        virtual std::unique_ptr< HIDDevice > open(const std::string &path) = 0;
+
+        // The transport every keyboard operation goes through: hidapi, unless
+        // another one has been set, or unless $NUDELTA_SIMULATE lists models
+        // to simulate (see simulator.hpp).
+        static std::shared_ptr< HIDTransport > get();
+        static void set(std::shared_ptr< HIDTransport > transport);
+};
+
+class HidapiTransport : public HIDTransport {
+    public:
+        virtual std::vector< HIDDeviceInfo >
+        enumerate(uint16_t vendorID, uint16_t productID);
+        virtual std::unique_ptr< HIDDevice > open(const std::string &path);
+};
+
+#endif
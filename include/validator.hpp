@@ -0,0 +1,57 @@
+/*
+    Nudelta Console
+    Copyright (C) 2022 Mohamed Gaber
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#ifndef _validator_hpp
+#define _validator_hpp
+
+#include "nuphy.hpp"
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Validates successive versions of one profile as it is edited, e.g. on
+// every keystroke in an editor, against a keyboard model.
+//
+// Each entry of the keys and mackeys maps is parsed and checked on its own,
+// and only if its text changed since the previous version: the diagnostics
+// of unchanged entries are reused, moved to wherever the entry is now.
+// Documents that cannot be split into entries safely (flow-style maps,
+// anchors and aliases, syntax errors, ...) are validated as a whole, exactly
+// as NuPhy::diagnoseYAMLKeymap does.
+class IncrementalValidator {
+    public:
+        IncrementalValidator(std::shared_ptr< NuPhy > keyboard, bool rawOk);
+
+        std::vector< NuPhy::Diagnostic > update(const std::string &yamlString);
+
+        // The number of entries parsed and checked by the last update, or
+        // -1 if the whole document was.
+        int getEntriesChecked() const { return entriesChecked; }
+    private:
+        std::shared_ptr< NuPhy > keyboard;
+        bool rawOk;
+        int entriesChecked = 0;
+
+        // Diagnostics by hash of an entry's mode and text, with lines
+        // relative to the entry's first line
+        std::unordered_map< uint64_t, std::vector< NuPhy::Diagnostic > >
+            checked;
+};
+
+#endif
@@ -63,7 +63,20 @@ function createWindow() {
                             );
 
                             try {
-                                libnd.validateYAML(value);
+                                let diagnostics = validateConfig(
+                                    mainWindow.webContents,
+                                    value
+                                );
+                                if (diagnostics === null) {
+                                    await libnd.validateYAMLAsync(value);
+                                } else if (diagnostics.length != 0) {
+                                    let { message, line } = diagnostics[0];
+                                    throw new Error(
+                                        line
+                                            ? `Line ${line}: ${message}`
+                                            : message
+                                    );
+                                }
 
                                 let config = YAML.parse(value);
 
@@ -112,7 +125,7 @@ function createWindow() {
                         label: "Reload Keyboard",
                         accelerator: "CommandOrControl+R",
                         click: async () => {
-                            sendKeyboardInfo(mainWindow);
+                            sendKeyboardInfo(mainWindow.webContents);
                         },
                     },
                     macOS ? { role: "close" } : { role: "quit" },
@@ -171,6 +184,17 @@ function createWindow() {
 app.whenReady().then(() => {
     createWindow();
 
+    // A keyboard exposes several HID interfaces, so coalesce their events
+    let hotplugTimer = null;
+    libnd.subscribeHotplug(() => {
+        clearTimeout(hotplugTimer);
+        hotplugTimer = setTimeout(() => {
+            for (let window of BrowserWindow.getAllWindows()) {
+                sendKeyboardInfo(window.webContents);
+            }
+        }, 250);
+    });
+
     app.on("activate", function () {
         if (BrowserWindow.getAllWindows().length === 0) createWindow();
     });
@@ -185,9 +209,29 @@ ipcMain.on("save-config-reply", async (_, { config, filePath }) => {
     await fs.writeFile(filePath, string);
 });
 
+// Profiles are checked against the model of the keyboard each window was
+// last told about, so that checking never enumerates devices, and with one
+// validator per window, so that only the entries changed since its last
+// check are checked again. Returns null if no keyboard is known yet.
+const validators = new WeakMap();
+
+function validateConfig(sender, yaml) {
+    let model = sender.keyboardModel;
+    if (model === undefined) {
+        return null;
+    }
+    let validator = validators.get(sender);
+    if (validator?.model !== model) {
+        validator = { model, update: libnd.createValidator(model) };
+        validators.set(sender, validator);
+    }
+    return validator.update(yaml);
+}
+
 async function sendKeyboardInfo(sender) {
     try {
-        let info = libnd.getKeyboardInfo();
+        let info = await libnd.getKeyboardInfoAsync();
+        sender.keyboardModel = info?.kind;
         sender.send("get-keyboard-info-reply", { info });
     } catch (err) {
         let message = err.message;
@@ -204,11 +248,21 @@ async function sendKeyboardInfo(sender) {
 
 ipcMain.on("get-keyboard-info", (ev) => sendKeyboardInfo(ev.sender));
 
+ipcMain.on("validate-config", (ev, config) => {
+    let diagnostics;
+    try {
+        diagnostics = validateConfig(ev.sender, YAML.stringify(config)) ?? [];
+    } catch (err) {
+        diagnostics = [{ message: err.message, line: 0, column: 0 }];
+    }
+    ev.sender.send("validate-config-reply", { diagnostics });
+});
+
 ipcMain.on("write-yaml", async (ev, config) => {
     let serialized = YAML.stringify(config);
     console.log(`Writing ${serialized}...`);
     try {
-        libnd.setKeymapFromYAML(serialized);
+        await libnd.setKeymapFromYAMLAsync(serialized);
     } catch (err) {
         let message = err.message;
         console.log(err.kind)
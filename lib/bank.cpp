@@ -0,0 +1,213 @@
+/*
+    Nudelta Console
+    Copyright (C) 2022 Mohamed Gaber
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include "bank.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <fmt/core.h>
+#include <set>
+
+static const uint8_t BANK_MAGIC[] = {'N', 'D', 'P', 'B'};
+static const size_t BANK_HEADER_SIZE = 32;
+static const size_t ENTRY_SIZE = 24;
+
+static uint64_t
+hashKey(const char *name, size_t nameSize, const std::string &model) {
+    static const char separator = '\0';
+    auto hash = fnv1a64(name, nameSize);
+    hash = fnv1a64(&separator, 1, hash);
+    return fnv1a64(model.data(), model.size(), hash);
+}
+
+static uint64_t readLE64(const uint8_t *bytes) {
+    return uint64_t(readLE32(bytes)) | (uint64_t(readLE32(bytes + 4)) << 32);
+}
+
+static void writeLE64(uint8_t *bytes, uint64_t value) {
+    writeLE32(bytes, uint32_t(value));
+    writeLE32(bytes + 4, uint32_t(value >> 32));
+}
+
+struct EntryRecord {
+        uint64_t hash;
+        Span< uint8_t > name;
+        Span< uint8_t > file;
+};
+
+static EntryRecord readEntry(const uint8_t *entry, const MappedFile &mapping) {
+    auto size = mapping.size();
+    auto nameOffset = readLE32(entry + 8);
+    auto nameSize = readLE32(entry + 12);
+    auto fileOffset = readLE32(entry + 16);
+    auto fileSize = readLE32(entry + 20);
+    if (nameOffset > size || nameSize > size - nameOffset || fileOffset > size
+        || fileSize > size - fileOffset) {
+        throw profile_bank_error("An entry lies outside the file.");
+    }
+    return {
+        readLE64(entry),
+        Span< uint8_t >(mapping.data() + nameOffset, nameSize),
+        Span< uint8_t >(mapping.data() + fileOffset, fileSize)};
+}
+
+// Appends `data`, padded so whatever follows is 8-byte aligned, and returns
+// the offset it was stored at.
+static uint32_t
+append(std::vector< uint8_t > &bytes, const void *data, size_t size) {
+    auto offset = bytes.size();
+    bytes.resize(offset + ((size + 7) & ~size_t(7)));
+    memcpy(bytes.data() + offset, data, size);
+    return uint32_t(offset);
+}
+
+std::vector< uint8_t >
+ProfileBank::build(const std::vector< Entry > &entries) {
+    std::set< std::pair< std::string, std::string > > seen;
+    for (auto &entry : entries) {
+        if (!seen.insert({entry.name, entry.profile.model}).second) {
+            throw profile_bank_error(fmt::format(
+                "The profile '{}' was added twice for the NuPhy {}.",
+                entry.name,
+                entry.profile.model
+            ));
+        }
+    }
+
+    // At most half full, so probe sequences stay short
+    uint32_t bucketCount = 1;
+    while (bucketCount < entries.size() * 2) {
+        bucketCount *= 2;
+    }
+    uint32_t bucketsOffset = BANK_HEADER_SIZE;
+    uint32_t entriesOffset = (bucketsOffset + bucketCount * 4 + 7) & ~7u;
+
+    std::vector< uint8_t > bytes(entriesOffset + entries.size() * ENTRY_SIZE);
+    std::copy(BANK_MAGIC, BANK_MAGIC + 4, bytes.data());
+    writeLE32(bytes.data() + 4, VERSION);
+    writeLE32(bytes.data() + 8, uint32_t(entries.size()));
+    writeLE32(bytes.data() + 12, bucketCount);
+    writeLE32(bytes.data() + 16, bucketsOffset);
+    writeLE32(bytes.data() + 20, entriesOffset);
+
+    for (size_t i = 0; i < entries.size(); i += 1) {
+        auto &name = entries[i].name;
+        auto &profile = entries[i].profile;
+        auto hash = hashKey(name.data(), name.size(), profile.model);
+
+        auto nameOffset = append(bytes, name.data(), name.size());
+        auto file = KeymapFile::encode(profile);
+        auto fileOffset = append(bytes, file.data(), file.size());
+
+        auto entry = bytes.data() + entriesOffset + i * ENTRY_SIZE;
+        writeLE64(entry, hash);
+        writeLE32(entry + 8, nameOffset);
+        writeLE32(entry + 12, uint32_t(name.size()));
+        writeLE32(entry + 16, fileOffset);
+        writeLE32(entry + 20, uint32_t(file.size()));
+
+        auto mask = bucketCount - 1;
+        auto bucket = uint32_t(hash) & mask;
+        while (readLE32(bytes.data() + bucketsOffset + bucket * 4) != 0) {
+            bucket = (bucket + 1) & mask;
+        }
+        writeLE32(bytes.data() + bucketsOffset + bucket * 4, uint32_t(i + 1));
+    }
+
+    return bytes;
+}
+
+std::shared_ptr< ProfileBank > ProfileBank::open(const std::string &path) {
+    std::shared_ptr< MappedFile > mapping = MappedFile::open(path);
+    try {
+        return std::shared_ptr< ProfileBank >(new ProfileBank(mapping));
+    } catch (profile_bank_error &e) {
+        throw profile_bank_error(fmt::format("'{}': {}", path, e.what()));
+    }
+}
+
+ProfileBank::ProfileBank(std::shared_ptr< MappedFile > mapping)
+    : mapping(mapping) {
+    auto size = mapping->size();
+    auto header = mapping->data();
+    if (size < BANK_HEADER_SIZE
+        || !std::equal(BANK_MAGIC, BANK_MAGIC + 4, header)) {
+        throw profile_bank_error("Not a profile bank.");
+    }
+    auto version = readLE32(header + 4);
+    if (version != VERSION) {
+        throw profile_bank_error(
+            fmt::format("Unsupported profile bank version {}.", version)
+        );
+    }
+
+    entryCount = readLE32(header + 8);
+    bucketCount = readLE32(header + 12);
+    auto bucketsOffset = readLE32(header + 16);
+    auto entriesOffset = readLE32(header + 20);
+    if (bucketCount == 0 || (bucketCount & (bucketCount - 1)) != 0
+        || entryCount > bucketCount || bucketsOffset > size
+        || (size - bucketsOffset) / 4 < bucketCount || entriesOffset > size
+        || (size - entriesOffset) / ENTRY_SIZE < entryCount) {
+        throw profile_bank_error("The index lies outside the file.");
+    }
+    buckets = header + bucketsOffset;
+    entries = header + entriesOffset;
+}
+
+std::shared_ptr< KeymapFile >
+ProfileBank::find(const std::string &name, const std::string &model) const {
+    auto hash = hashKey(name.data(), name.size(), model);
+    auto mask = bucketCount - 1;
+
+    auto bucket = uint32_t(hash) & mask;
+    for (uint32_t probes = 0; probes < bucketCount; probes += 1) {
+        auto index = readLE32(buckets + bucket * 4);
+        if (index == 0 || index > entryCount) {
+            return nullptr;
+        }
+        bucket = (bucket + 1) & mask;
+
+        auto entry = entries + (index - 1) * ENTRY_SIZE;
+        if (readLE64(entry) != hash) {
+            continue;
+        }
+        auto record = readEntry(entry, *mapping);
+        if (name.size() != record.name.size()
+            || memcmp(name.data(), record.name.data(), name.size()) != 0) {
+            continue;
+        }
+
+        auto file = KeymapFile::view(record.file, mapping);
+        if (file->getModel() == model) {
+            return file;
+        }
+    }
+    return nullptr;
+}
+
+std::vector< std::pair< std::string, std::string > > ProfileBank::list() const {
+    std::vector< std::pair< std::string, std::string > > names;
+    for (uint32_t i = 0; i < entryCount; i += 1) {
+        auto record = readEntry(entries + i * ENTRY_SIZE, *mapping);
+        names.emplace_back(
+            std::string(record.name.begin(), record.name.end()),
+            KeymapFile::view(record.file, mapping)->getModel()
+        );
+    }
+    return names;
+}
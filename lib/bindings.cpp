@@ -0,0 +1,91 @@
+/*
+    Nudelta Console
+    Copyright (C) 2022 Mohamed Gaber
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include "bindings.hpp"
+
+#include <filesystem>
+#include <fmt/format.h>
+#include <fstream>
+#include <yaml-cpp/yaml.h>
+
+static void loadSection(
+    const YAML::Node &config,
+    const char *section,
+    const std::filesystem::path &base,
+    std::unordered_map< std::string, ProfileBindings::Binding > &bindings
+) {
+    auto entries = config[section];
+    if (!entries.IsDefined() || entries.IsNull()) {
+        return;
+    }
+    if (!entries.IsMap()) {
+        throw std::runtime_error(
+            fmt::format("'{}' must map keyboards to profiles.", section)
+        );
+    }
+
+    for (auto entry : entries) {
+        auto key = entry.first.as< std::string >();
+        auto profilePath = base / entry.second.as< std::string >();
+
+        std::ifstream file(profilePath);
+        if (!file) {
+            throw std::runtime_error(fmt::format(
+                "Failed to open profile '{}' bound to '{}'.",
+                profilePath.string(),
+                key
+            ));
+        }
+        ProfileBindings::Binding binding = {profilePath.string(), ""};
+        std::getline(file, binding.yaml, '\0');
+        bindings[key] = binding;
+    }
+}
+
+ProfileBindings ProfileBindings::load(const std::string &path) {
+    YAML::Node config;
+    try {
+        config = YAML::LoadFile(path);
+    } catch (YAML::Exception &e) {
+        throw std::runtime_error(
+            fmt::format("Failed to load bindings '{}': {}", path, e.what())
+        );
+    }
+
+    auto base = std::filesystem::path(path).parent_path();
+    ProfileBindings bindings;
+    loadSection(config, "serials", base, bindings.bySerial);
+    loadSection(config, "paths", base, bindings.byPath);
+    return bindings;
+}
+
+const ProfileBindings::Binding *
+ProfileBindings::find(const NuPhy &keyboard) const {
+    if (keyboard.serialNumber.has_value()) {
+        auto binding = bySerial.find(keyboard.serialNumber.value());
+        if (binding != bySerial.end()) {
+            return &binding->second;
+        }
+    }
+    for (auto path : {&keyboard.dataPath, &keyboard.requestPath}) {
+        auto binding = byPath.find(*path);
+        if (binding != byPath.end()) {
+            return &binding->second;
+        }
+    }
+    return nullptr;
+}
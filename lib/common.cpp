@@ -21,16 +21,43 @@ std::string to_utf8(std::wstring in) {
     return std::wstring_convert< std::codecvt_utf8< wchar_t > >().to_bytes(in);
 }
 
-void prettyPrintBinary(const std::vector< uint8_t > &in, FILE *f) {
-    size_t offset = 0;
-    for (auto element : in) {
+static void appendHex(std::string &out, size_t value, int digits) {
+    static const char HEX_DIGITS[] = "0123456789abcdef";
+    while (digits < int(sizeof value * 2) && (value >> (digits * 4)) != 0) {
+        digits += 1;
+    }
+    for (int i = digits - 1; i >= 0; i -= 1) {
+        out.push_back(HEX_DIGITS[(value >> (i * 4)) & 0xf]);
+    }
+}
+
+std::string formatBinary(
+    const uint8_t *data,
+    size_t size,
+    const std::vector< std::string > &annotations
+) {
+    std::string out;
+    out.reserve(size / 4 * 20); // "0000  00 00 00 00 \n" for each word
+    for (size_t offset = 0; offset < size; offset += 1) {
         if (offset % 4 == 0) {
-            p(f, "{:04x}  ", offset);
+            appendHex(out, offset, 4);
+            out.append("  ");
         }
-        p(f, "{:02x} ", element);
-        offset += 1;
-        if (offset % 4 == 0) {
-            p(f, "\n");
+        appendHex(out, data[offset], 2);
+        out.push_back(' ');
+        if (offset % 4 == 3) {
+            auto word = offset / 4;
+            if (word < annotations.size() && !annotations[word].empty()) {
+                out.append(" ");
+                out.append(annotations[word]);
+            }
+            out.push_back('\n');
         }
     }
+    return out;
+}
+
+void prettyPrintBinary(const std::vector< uint8_t > &in, FILE *f) {
+    auto out = formatBinary(in.data(), in.size());
+    fwrite(out.data(), 1, out.size(), f);
 }
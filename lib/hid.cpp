@@ -16,20 +16,117 @@
     along with this program.  If not, see <https://www.gnu.org/licenses/>.
 */
 
-#include "common.hpp"
+#include "simulator.hpp"
+#include "transport.hpp"
 
+#include <cstdlib>
 #include <hidapi.h>
+#include <mutex>
+#include <scope_guard.hpp>
+#include <stdexcept>
 
-class Hid {
+// Deferred until a device is actually enumerated or opened, so commands that
+// never touch a keyboard (--version, --help, validation, etc.) skip it
+// entirely.
+void initHID() {
+    static std::once_flag initialized;
+    std::call_once(initialized, []() {
+        if (hid_init()) {
+            throw std::runtime_error("Failed to initialize HID library.");
+        }
+        atexit([]() { hid_exit(); });
+    });
+}
+
+static std::mutex transportMutex;
+static std::shared_ptr< HIDTransport > currentTransport;
+
+std::shared_ptr< HIDTransport > HIDTransport::get() {
+    std::lock_guard< std::mutex > lock(transportMutex);
+    if (currentTransport == nullptr) {
+        auto simulated = SimulatedTransport::fromEnvironment();
+        if (simulated != nullptr) {
+            currentTransport = simulated;
+        } else {
+            currentTransport = std::make_shared< HidapiTransport >();
+        }
+    }
+    return currentTransport;
+}
+
+void HIDTransport::set(std::shared_ptr< HIDTransport > transport) {
+    std::lock_guard< std::mutex > lock(transportMutex);
+    currentTransport = transport;
+}
+
+// hidapi does not guarantee that enumerating, opening and closing devices is
+// thread-safe, only that different devices may be read from and written to
+// concurrently.
+static std::mutex hidLifecycleMutex;
+
+static std::optional< std::string > optionalUTF8(const wchar_t *string) {
+    if (string == nullptr) {
+        return std::nullopt;
+    }
+    return to_utf8(string);
+}
+
+class HidapiDevice : public HIDDevice {
     public:
-        Hid() {
-            if (hid_init()) {
-                p(stderr, "Failed to initialize HID library.\n");
-                exit(-1);
-            }
+        HidapiDevice(hid_device *handle) : handle(handle) {}
+        virtual ~HidapiDevice() {
+            std::lock_guard< std::mutex > lock(hidLifecycleMutex);
+            hid_close(handle);
         }
 
-        ~Hid() { hid_exit(); }
+        virtual int sendFeatureReport(const uint8_t *data, size_t size) {
+            return hid_send_feature_report(handle, data, size);
+        }
+        virtual int getFeatureReport(uint8_t *data, size_t size) {
+            return hid_get_feature_report(handle, data, size);
+        }
+        virtual std::string getError() {
+            return optionalUTF8(hid_error(handle)).value_or("Unknown error");
+        }
+    private:
+        hid_device *handle;
 };
 
-auto _ = Hid();
\ No newline at end of file
+std::vector< HIDDeviceInfo >
+HidapiTransport::enumerate(uint16_t vendorID, uint16_t productID) {
+    initHID();
+
+    std::vector< HIDDeviceInfo > devices;
+    // Polling hotplug monitors enumerate from their own thread
+    std::lock_guard< std::mutex > lock(hidLifecycleMutex);
+    auto seeker = hid_enumerate(vendorID, productID);
+    SCOPE_EXIT {
+        hid_free_enumeration(seeker);
+    };
+    for (auto info = seeker; info != nullptr; info = info->next) {
+        devices.push_back(
+            {info->path,
+             info->vendor_id,
+             info->product_id,
+             optionalUTF8(info->serial_number),
+             info->release_number,
+             optionalUTF8(info->manufacturer_string),
+             optionalUTF8(info->product_string),
+             info->usage_page,
+             info->usage,
+             info->interface_number}
+        );
+    }
+    return devices;
+}
+
+std::unique_ptr< HIDDevice > HidapiTransport::open(const std::string &path) {
+    initHID();
+
+    std::lock_guard< std::mutex > lock(hidLifecycleMutex);
+    auto handle = hid_open_path(path.c_str());
+    if (handle == nullptr) {
+        return nullptr;
+    }
+    return std::make_unique< HidapiDevice >(handle);
+}
@@ -0,0 +1,218 @@
+/*
+    Nudelta Console
+    Copyright (C) 2022 Mohamed Gaber
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include "hotplug.hpp"
+
+#include <stdexcept>
+
+#if defined(__gnu_linux__)
+    #include <arpa/inet.h>
+    #include <cerrno>
+    #include <cstring>
+    #include <fcntl.h>
+    #include <linux/netlink.h>
+    #include <poll.h>
+    #include <sys/socket.h>
+    #include <unistd.h>
+
+static const unsigned int KERNEL_GROUP = 1;
+static const unsigned int UDEV_GROUP = 2;
+
+HotplugMonitor::HotplugMonitor(Callback callback)
+    : callback(callback), running(true) {
+    socket = ::socket(
+        AF_NETLINK,
+        SOCK_RAW | SOCK_CLOEXEC | SOCK_NONBLOCK,
+        NETLINK_KOBJECT_UEVENT
+    );
+    if (socket < 0) {
+        throw std::runtime_error(fmt::format(
+            "Failed to open a uevent socket: {}",
+            strerror(errno)
+        ));
+    }
+
+    // udev re-broadcasts events once the device node exists and its
+    // permissions are set, which is when it is actually safe to open
+    bool udevRunning = access("/run/udev/control", F_OK) == 0;
+
+    sockaddr_nl address = {};
+    address.nl_family = AF_NETLINK;
+    address.nl_groups = udevRunning ? UDEV_GROUP : KERNEL_GROUP;
+    if (bind(socket, (sockaddr *)&address, sizeof address) < 0
+        || pipe2(stopPipe, O_CLOEXEC) < 0) {
+        auto error = strerror(errno);
+        close(socket);
+        throw std::runtime_error(
+            fmt::format("Failed to listen for uevents: {}", error)
+        );
+    }
+
+    thread = std::thread(&HotplugMonitor::run, this);
+}
+
+HotplugMonitor::~HotplugMonitor() {
+    running = false;
+    char byte = 0;
+    if (write(stopPipe[1], &byte, 1) < 0) {
+        // The thread still exits within the next poll timeout
+    }
+    thread.join();
+    close(stopPipe[0]);
+    close(stopPipe[1]);
+    close(socket);
+}
+
+// Splits a uevent into its properties. Kernel messages are
+// "action@devpath\0KEY=VALUE\0...", udev ones have a binary header that
+// points at the same KEY=VALUE list.
+static std::vector< std::pair< std::string, std::string > >
+parseUevent(const char *buffer, size_t size) {
+    size_t offset = 0;
+    if (size >= 40 && memcmp(buffer, "libudev", 8) == 0) {
+        uint32_t magic, propertiesOffset, propertiesLength;
+        memcpy(&magic, buffer + 8, 4);
+        memcpy(&propertiesOffset, buffer + 16, 4);
+        memcpy(&propertiesLength, buffer + 20, 4);
+        if (ntohl(magic) != 0xfeedcafe || propertiesOffset > size
+            || propertiesLength > size - propertiesOffset) {
+            return {};
+        }
+        offset = propertiesOffset;
+        size = propertiesOffset + propertiesLength;
+    } else {
+        offset = strnlen(buffer, size) + 1;
+    }
+
+    std::vector< std::pair< std::string, std::string > > properties;
+    while (offset < size) {
+        auto length = strnlen(buffer + offset, size - offset);
+        auto property = std::string(buffer + offset, length);
+        auto separator = property.find('=');
+        if (separator != std::string::npos) {
+            properties.emplace_back(
+                property.substr(0, separator),
+                property.substr(separator + 1)
+            );
+        }
+        offset += length + 1;
+    }
+    return properties;
+}
+
+void HotplugMonitor::run() {
+    char buffer[8192];
+    pollfd fds[] = {{socket, POLLIN, 0}, {stopPipe[0], POLLIN, 0}};
+    while (running) {
+        if (poll(fds, 2, 1000) <= 0 || fds[1].revents != 0) {
+            continue;
+        }
+
+        auto received = recv(socket, buffer, sizeof buffer - 1, 0);
+        if (received <= 0) {
+            continue;
+        }
+        buffer[received] = '\0';
+
+        std::string action, subsystem, devicePath, deviceName;
+        for (auto &[key, value] : parseUevent(buffer, size_t(received))) {
+            if (key == "ACTION") {
+                action = value;
+            } else if (key == "SUBSYSTEM") {
+                subsystem = value;
+            } else if (key == "DEVPATH") {
+                devicePath = value;
+            } else if (key == "DEVNAME") {
+                deviceName = value;
+            }
+        }
+
+        // e.g. /devices/.../0003:05AC:024F.0005/hidraw/hidraw3
+        if (subsystem != "hidraw" || deviceName.empty()
+            || devicePath.find(":05AC:024F.") == std::string::npos) {
+            continue;
+        }
+        if (deviceName[0] != '/') {
+            deviceName = "/dev/" + deviceName;
+        }
+
+        if (action == "add") {
+            callback({true, deviceName});
+        } else if (action == "remove") {
+            callback({false, deviceName});
+        }
+    }
+}
+
+#else
+    #include "transport.hpp"
+
+    #include <algorithm>
+    #include <chrono>
+
+HotplugMonitor::HotplugMonitor(Callback callback)
+    : callback(callback), running(true) {
+    thread = std::thread(&HotplugMonitor::run, this);
+}
+
+HotplugMonitor::~HotplugMonitor() {
+    {
+        std::lock_guard< std::mutex > lock(stopMutex);
+        running = false;
+    }
+    stopCondition.notify_all();
+    thread.join();
+}
+
+static std::vector< std::string > enumeratePaths() {
+    std::vector< std::string > paths;
+    for (auto &info : HIDTransport::get()->enumerate(0x05ac, 0x024f)) {
+        paths.push_back(info.path);
+    }
+    std::sort(paths.begin(), paths.end());
+    paths.erase(std::unique(paths.begin(), paths.end()), paths.end());
+    return paths;
+}
+
+void HotplugMonitor::run() {
+    auto known = enumeratePaths();
+    while (true) {
+        {
+            std::unique_lock< std::mutex > lock(stopMutex);
+            stopCondition.wait_for(lock, std::chrono::seconds(1), [this]() {
+                return !running;
+            });
+            if (!running) {
+                return;
+            }
+        }
+
+        auto current = enumeratePaths();
+        for (auto &path : current) {
+            if (!std::binary_search(known.begin(), known.end(), path)) {
+                callback({true, path});
+            }
+        }
+        for (auto &path : known) {
+            if (!std::binary_search(current.begin(), current.end(), path)) {
+                callback({false, path});
+            }
+        }
+        known = current;
+    }
+}
+#endif
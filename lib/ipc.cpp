@@ -0,0 +1,324 @@
+/*
+    Nudelta Console
+    Copyright (C) 2022 Mohamed Gaber
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include "ipc.hpp"
+
+#include "report.hpp"
+
+#include <cstdlib>
+#include <cstring>
+#include <fmt/core.h>
+
+#if defined(_WIN32)
+
+// AF_UNIX sockets exist on recent versions of Windows, but nudeltad does not
+// run there, so there is nothing to connect to either.
+namespace IPC {
+    std::string getDefaultSocketPath() { return ""; }
+
+    std::unique_ptr< Connection > Connection::connect(const std::string &) {
+        throw ipc_error("The nudelta daemon is not supported on Windows.");
+    }
+    Connection::~Connection() {}
+    void Connection::interrupt() {}
+    void Connection::send(const Message &) {}
+    std::optional< Message > Connection::receive() { return std::nullopt; }
+    Message Connection::call(const Message &) { return {}; }
+
+    Listener::Listener(const std::string &path) : path(path), fd(-1) {
+        throw ipc_error("The nudelta daemon is not supported on Windows.");
+    }
+    Listener::~Listener() {}
+    std::unique_ptr< Connection > Listener::accept(int) { return nullptr; }
+}
+
+#else
+    #include <cerrno>
+    #include <fcntl.h>
+    #include <poll.h>
+    #include <sys/socket.h>
+    #include <sys/stat.h>
+    #include <sys/un.h>
+    #include <unistd.h>
+
+    #if defined(MSG_NOSIGNAL)
+static const int SEND_FLAGS = MSG_NOSIGNAL;
+    #else
+static const int SEND_FLAGS = 0; // SO_NOSIGPIPE is set instead
+    #endif
+
+// A stream socket that is neither inherited by children nor raises SIGPIPE
+// when written to after the other end is gone.
+static int prepareSocket(int fd) {
+    if (fd < 0) {
+        throw ipc_error(
+            fmt::format("Failed to create socket: {}", strerror(errno))
+        );
+    }
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+    #if defined(SO_NOSIGPIPE)
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof one);
+    #endif
+    return fd;
+}
+
+static sockaddr_un makeAddress(const std::string &path) {
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    if (path.size() >= sizeof address.sun_path) {
+        throw ipc_error(fmt::format("Socket path '{}' is too long.", path));
+    }
+    memcpy(address.sun_path, path.c_str(), path.size() + 1);
+    return address;
+}
+
+static void writeAll(int fd, const uint8_t *bytes, size_t size) {
+    while (size != 0) {
+        auto written = ::send(fd, bytes, size, SEND_FLAGS);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw ipc_error(
+                fmt::format("Failed to write to socket: {}", strerror(errno))
+            );
+        }
+        bytes += written;
+        size -= written;
+    }
+}
+
+// Returns false if the connection was closed before anything was read.
+static bool readAll(int fd, uint8_t *bytes, size_t size) {
+    size_t total = 0;
+    while (total != size) {
+        auto result = ::recv(fd, bytes + total, size - total, 0);
+        if (result < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw ipc_error(
+                fmt::format("Failed to read from socket: {}", strerror(errno))
+            );
+        }
+        if (result == 0) {
+            if (total == 0) {
+                return false;
+            }
+            throw ipc_error("Connection closed in the middle of a message.");
+        }
+        total += result;
+    }
+    return true;
+}
+
+namespace IPC {
+    std::string getDefaultSocketPath() {
+        auto socket = getenv("NUDELTA_SOCKET");
+        if (socket != nullptr && *socket != '\0') {
+            return socket;
+        }
+        auto runtimeDir = getenv("XDG_RUNTIME_DIR");
+        if (runtimeDir != nullptr && *runtimeDir != '\0') {
+            return fmt::format("{}/nudelta.sock", runtimeDir);
+        }
+        // Anyone can create files in /tmp, so the socket goes in a directory
+        // only this user can have created and written to.
+        auto directory = fmt::format("/tmp/nudelta-{}", getuid());
+        if (mkdir(directory.c_str(), 0700) < 0 && errno != EEXIST) {
+            throw ipc_error(fmt::format(
+                "Failed to create '{}': {}",
+                directory,
+                strerror(errno)
+            ));
+        }
+        struct stat info;
+        if (lstat(directory.c_str(), &info) < 0 || !S_ISDIR(info.st_mode)
+            || info.st_uid != getuid() || (info.st_mode & 0077) != 0) {
+            throw ipc_error(fmt::format(
+                "Refusing to use '{}': it is not a private directory owned by this user. Set $NUDELTA_SOCKET or $XDG_RUNTIME_DIR instead.",
+                directory
+            ));
+        }
+        return fmt::format("{}/nudelta.sock", directory);
+    }
+
+    std::unique_ptr< Connection > Connection::connect(const std::string &path
+    ) {
+        auto address = makeAddress(path);
+        int fd = prepareSocket(::socket(AF_UNIX, SOCK_STREAM, 0));
+        if (::connect(fd, (sockaddr *)&address, sizeof address) < 0) {
+            auto error = strerror(errno);
+            close(fd);
+            throw ipc_error(fmt::format(
+                "Failed to connect to the nudelta daemon at '{}': {}",
+                path,
+                error
+            ));
+        }
+        return std::make_unique< Connection >(fd);
+    }
+
+    Connection::~Connection() { close(fd); }
+
+    void Connection::interrupt() { ::shutdown(fd, SHUT_RD); }
+
+    void Connection::send(const Message &message) {
+        auto payload = encode(message);
+        uint8_t header[4];
+        writeLE32(header, uint32_t(payload.size()));
+        writeAll(fd, header, sizeof header);
+        writeAll(fd, payload.data(), payload.size());
+    }
+
+    std::optional< Message > Connection::receive() {
+        uint8_t header[4];
+        if (!readAll(fd, header, sizeof header)) {
+            return std::nullopt;
+        }
+        auto size = readLE32(header);
+        if (size > MAX_FRAME_SIZE) {
+            throw ipc_error(fmt::format("Refusing a {}-byte message.", size));
+        }
+        std::vector< uint8_t > payload(size);
+        if (size != 0 && !readAll(fd, payload.data(), size)) {
+            throw ipc_error("Connection closed in the middle of a message.");
+        }
+        auto message = decode(payload.data(), payload.size());
+        if (!message.has_value()) {
+            throw ipc_error("Received a malformed message.");
+        }
+        return message;
+    }
+
+    Message Connection::call(const Message &request) {
+        send(request);
+        auto response = receive();
+        if (!response.has_value()) {
+            throw ipc_error("The nudelta daemon closed the connection.");
+        }
+        return response.value();
+    }
+
+    Listener::Listener(const std::string &path) : path(path) {
+        auto address = makeAddress(path);
+
+        // Only replace the socket if nothing answers on it anymore
+        struct stat info;
+        if (lstat(path.c_str(), &info) == 0) {
+            if (!S_ISSOCK(info.st_mode)) {
+                throw ipc_error(fmt::format(
+                    "'{}' exists and is not a socket.",
+                    path
+                ));
+            }
+            bool live = false;
+            try {
+                Connection::connect(path);
+                live = true;
+            } catch (ipc_error &) {
+            }
+            if (live) {
+                throw ipc_error(fmt::format(
+                    "Another nudelta daemon is already listening on '{}'.",
+                    path
+                ));
+            }
+            unlink(path.c_str());
+        }
+
+        fd = prepareSocket(::socket(AF_UNIX, SOCK_STREAM, 0));
+
+        // Keymaps can be written by anyone able to connect, so only the
+        // user running the daemon may.
+        auto oldMask = umask(0077);
+        auto bound = bind(fd, (sockaddr *)&address, sizeof address);
+        umask(oldMask);
+        if (bound < 0 || listen(fd, 16) < 0) {
+            auto error = strerror(errno);
+            close(fd);
+            throw ipc_error(
+                fmt::format("Failed to listen on '{}': {}", path, error)
+            );
+        }
+    }
+
+    Listener::~Listener() {
+        close(fd);
+        unlink(path.c_str());
+    }
+
+    std::unique_ptr< Connection > Listener::accept(int timeoutMs) {
+        pollfd descriptor = {fd, POLLIN, 0};
+        auto ready = poll(&descriptor, 1, timeoutMs);
+        if (ready <= 0) {
+            if (ready < 0 && errno != EINTR) {
+                throw ipc_error(
+                    fmt::format("Failed to poll socket: {}", strerror(errno))
+                );
+            }
+            return nullptr;
+        }
+        int client = ::accept(fd, nullptr, nullptr);
+        if (client < 0) {
+            return nullptr;
+        }
+        return std::make_unique< Connection >(prepareSocket(client));
+    }
+}
+
+#endif
+
+namespace IPC {
+    std::vector< uint8_t > encode(const Message &message) {
+        size_t size = 0;
+        for (auto &field : message) {
+            size += 4 + field.size();
+        }
+        if (size > MAX_FRAME_SIZE) {
+            throw ipc_error(fmt::format("Refusing to send {} bytes.", size));
+        }
+
+        std::vector< uint8_t > payload(size);
+        auto position = payload.data();
+        for (auto &field : message) {
+            writeLE32(position, uint32_t(field.size()));
+            memcpy(position + 4, field.data(), field.size());
+            position += 4 + field.size();
+        }
+        return payload;
+    }
+
+    std::optional< Message > decode(const uint8_t *payload, size_t size) {
+        Message message;
+        size_t offset = 0;
+        while (offset != size) {
+            if (size - offset < 4) {
+                return std::nullopt;
+            }
+            auto length = readLE32(payload + offset);
+            offset += 4;
+            if (size - offset < length) {
+                return std::nullopt;
+            }
+            message.emplace_back((const char *)payload + offset, length);
+            offset += length;
+        }
+        return message;
+    }
+}
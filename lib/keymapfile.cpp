@@ -0,0 +1,181 @@
+/*
+    Nudelta Console
+    Copyright (C) 2022 Mohamed Gaber
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include "keymapfile.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <fmt/core.h>
+
+static const uint8_t KEYMAP_FILE_MAGIC[] = {'N', 'D', 'K', 'M'};
+static const uint32_t HAS_KEYMAP_WIN = 1;
+static const uint32_t HAS_KEYMAP_MAC = 2;
+static const size_t CHECKSUM_OFFSET = 48;
+
+// The largest keymap a single report can carry
+static const size_t MAX_KEYMAP_WORDS = (MAX_REPORT_SIZE - 8) / 4;
+
+static uint64_t checksum(Span< uint8_t > bytes) {
+    auto hash = fnv1a64(bytes.data(), CHECKSUM_OFFSET);
+    return fnv1a64(
+        bytes.data() + KeymapFile::HEADER_SIZE,
+        bytes.size() - KeymapFile::HEADER_SIZE,
+        hash
+    );
+}
+
+std::vector< uint8_t > KeymapFile::encode(
+    const std::string &model,
+    uint16_t firmware,
+    Span< uint32_t > keymapWin,
+    Span< uint32_t > keymapMac
+) {
+    if (!keymapWin.empty() && !keymapMac.empty()
+        && keymapWin.size() != keymapMac.size()) {
+        throw keymap_file_error("Both keymaps must be the same size.");
+    }
+    if (model.size() > MAX_MODEL_SIZE) {
+        throw keymap_file_error(
+            fmt::format("Model name '{}' is too long.", model)
+        );
+    }
+    auto words = std::max(keymapWin.size(), keymapMac.size());
+
+    std::vector< uint8_t > bytes(HEADER_SIZE);
+    auto header = bytes.data();
+    std::copy(KEYMAP_FILE_MAGIC, KEYMAP_FILE_MAGIC + 4, header);
+    writeLE32(header + 4, VERSION);
+    writeLE32(header + 8, HEADER_SIZE);
+    std::copy(model.begin(), model.end(), header + 16);
+    writeLE32(header + 32, firmware);
+    writeLE32(header + 36, uint32_t(words));
+
+    uint32_t flags = 0;
+    size_t offset = HEADER_SIZE;
+    for (auto mac : {false, true}) {
+        auto keymap = mac ? keymapMac : keymapWin;
+        if (keymap.empty()) {
+            continue;
+        }
+        flags |= mac ? HAS_KEYMAP_MAC : HAS_KEYMAP_WIN;
+        writeLE32(bytes.data() + (mac ? 44 : 40), uint32_t(offset));
+        bytes.resize(offset + words * 4);
+        for (size_t i = 0; i < words; i += 1) {
+            writeLE32(bytes.data() + offset + i * 4, keymap[i]);
+        }
+        offset = bytes.size();
+    }
+    writeLE32(bytes.data() + 12, flags);
+
+    auto hash = checksum(bytes);
+    writeLE32(bytes.data() + CHECKSUM_OFFSET, uint32_t(hash));
+    writeLE32(bytes.data() + CHECKSUM_OFFSET + 4, uint32_t(hash >> 32));
+    return bytes;
+}
+
+std::vector< uint8_t > KeymapFile::encode(const CompiledProfile &profile) {
+    return encode(profile.model, 0, profile.keymapWin, profile.keymapMac);
+}
+
+std::shared_ptr< KeymapFile > KeymapFile::open(const std::string &path) {
+    std::shared_ptr< MappedFile > mapping = MappedFile::open(path);
+    try {
+        return view(mapping->bytes(), mapping);
+    } catch (keymap_file_error &e) {
+        throw keymap_file_error(fmt::format("'{}': {}", path, e.what()));
+    }
+}
+
+std::shared_ptr< KeymapFile >
+KeymapFile::fromBytes(std::vector< uint8_t > bytes) {
+    auto owner =
+        std::make_shared< const std::vector< uint8_t > >(std::move(bytes));
+    return view(*owner, owner);
+}
+
+std::shared_ptr< KeymapFile >
+KeymapFile::view(Span< uint8_t > bytes, std::shared_ptr< const void > owner) {
+    return std::shared_ptr< KeymapFile >(new KeymapFile(bytes, owner));
+}
+
+KeymapFile::KeymapFile(
+    Span< uint8_t > bytes,
+    std::shared_ptr< const void > owner
+)
+    : owner(owner) {
+    auto magic = bytes.data();
+    if (bytes.size() < 4
+        || !std::equal(KEYMAP_FILE_MAGIC, KEYMAP_FILE_MAGIC + 4, magic)) {
+        if (bytes.empty() || bytes.size() % 4 != 0
+            || bytes.size() / 4 > MAX_KEYMAP_WORDS) {
+            throw keymap_file_error(fmt::format(
+                "Not a keymap file, nor a raw keymap of at most {} words.",
+                MAX_KEYMAP_WORDS
+            ));
+        }
+        raw = true;
+        keymapWin = keymapMac = LE32View(bytes.data(), bytes.size() / 4);
+        return;
+    }
+
+    if (bytes.size() < HEADER_SIZE) {
+        throw keymap_file_error("Truncated header.");
+    }
+    auto header = bytes.data();
+    auto version = readLE32(header + 4);
+    if (version != VERSION) {
+        throw keymap_file_error(
+            fmt::format("Unsupported keymap file version {}.", version)
+        );
+    }
+    if (readLE32(header + 8) != HEADER_SIZE) {
+        throw keymap_file_error("Unexpected header size.");
+    }
+    auto expected = uint64_t(readLE32(header + CHECKSUM_OFFSET))
+        | (uint64_t(readLE32(header + CHECKSUM_OFFSET + 4)) << 32);
+    if (checksum(bytes) != expected) {
+        throw keymap_file_error("Checksum mismatch; the file is corrupt.");
+    }
+
+    auto modelBytes = (const char *)header + 16;
+    model = std::string(modelBytes, strnlen(modelBytes, MAX_MODEL_SIZE));
+    firmware = uint16_t(readLE32(header + 32));
+
+    auto flags = readLE32(header + 12);
+    auto words = readLE32(header + 36);
+    if (words > MAX_KEYMAP_WORDS) {
+        throw keymap_file_error("Keymaps are larger than a report.");
+    }
+    for (auto mac : {false, true}) {
+        if (!(flags & (mac ? HAS_KEYMAP_MAC : HAS_KEYMAP_WIN))) {
+            continue;
+        }
+        auto offset = readLE32(header + (mac ? 44 : 40));
+        if (offset < HEADER_SIZE || offset % 4 != 0
+            || offset > bytes.size() || words > (bytes.size() - offset) / 4) {
+            throw keymap_file_error("Keymap lies outside the file.");
+        }
+        (mac ? keymapMac : keymapWin) = LE32View(header + offset, words);
+    }
+}
+
+CompiledProfile KeymapFile::toProfile() const {
+    if (raw || !hasKeymap(false) || !hasKeymap(true)) {
+        throw keymap_file_error("Both modes' keymaps are required.");
+    }
+    return {model, keymapWin.toVector(), keymapMac.toVector()};
+}
@@ -0,0 +1,139 @@
+/*
+    Nudelta Console
+    Copyright (C) 2022 Mohamed Gaber
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include "mapping.hpp"
+
+#include <fmt/core.h>
+#include <stdexcept>
+
+#if defined(_WIN32)
+    #define WIN32_LEAN_AND_MEAN
+    #include <windows.h>
+
+std::unique_ptr< MappedFile >
+MappedFile::open(const std::string &path, bool sequential) {
+    std::unique_ptr< MappedFile > mapped(new MappedFile());
+
+    auto file = CreateFileA(
+        path.c_str(),
+        GENERIC_READ,
+        FILE_SHARE_READ,
+        nullptr,
+        OPEN_EXISTING,
+        sequential ? FILE_FLAG_SEQUENTIAL_SCAN : FILE_ATTRIBUTE_NORMAL,
+        nullptr
+    );
+    if (file == INVALID_HANDLE_VALUE) {
+        throw std::runtime_error(
+            fmt::format("Failed to open '{}' for reading.", path)
+        );
+    }
+    mapped->file = file;
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size)) {
+        throw std::runtime_error(fmt::format("Failed to stat '{}'.", path));
+    }
+    mapped->length = size_t(size.QuadPart);
+    if (mapped->length == 0) {
+        return mapped; // Empty files cannot be mapped
+    }
+
+    mapped->mapping =
+        CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (mapped->mapping == nullptr) {
+        throw std::runtime_error(fmt::format("Failed to map '{}'.", path));
+    }
+    mapped->start = (const uint8_t *)
+        MapViewOfFile(mapped->mapping, FILE_MAP_READ, 0, 0, 0);
+    if (mapped->start == nullptr) {
+        throw std::runtime_error(fmt::format("Failed to map '{}'.", path));
+    }
+    return mapped;
+}
+
+MappedFile::~MappedFile() {
+    if (start != nullptr) {
+        UnmapViewOfFile(start);
+    }
+    if (mapping != nullptr) {
+        CloseHandle(mapping);
+    }
+    if (file != nullptr) {
+        CloseHandle(file);
+    }
+}
+
+#else
+    #include <cerrno>
+    #include <cstring>
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+
+std::unique_ptr< MappedFile >
+MappedFile::open(const std::string &path, bool sequential) {
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        throw std::runtime_error(fmt::format(
+            "Failed to open '{}' for reading: {}",
+            path,
+            strerror(errno)
+        ));
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) < 0) {
+        auto error = strerror(errno);
+        close(fd);
+        throw std::runtime_error(
+            fmt::format("Failed to stat '{}': {}", path, error)
+        );
+    }
+
+    std::unique_ptr< MappedFile > mapped(new MappedFile());
+    mapped->length = size_t(info.st_size);
+    if (mapped->length != 0) { // Empty files cannot be mapped
+        auto start =
+            mmap(nullptr, mapped->length, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (start == MAP_FAILED) {
+            auto error = strerror(errno);
+            close(fd);
+            throw std::runtime_error(
+                fmt::format("Failed to map '{}': {}", path, error)
+            );
+        }
+        mapped->start = (const uint8_t *)start;
+        if (sequential) {
+            // Only a hint: failing to take it is harmless
+            madvise(start, mapped->length, MADV_SEQUENTIAL);
+        }
+    }
+
+    // The mapping outlives the descriptor
+    close(fd);
+    return mapped;
+}
+
+MappedFile::~MappedFile() {
+    if (start != nullptr) {
+        munmap((void *)start, length);
+    }
+}
+
+#endif
@@ -0,0 +1,174 @@
+/*
+    Nudelta Console
+    Copyright (C) 2022 Mohamed Gaber
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include "model.hpp"
+
+#include "common.hpp"
+#include "modelpack.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <unordered_map>
+
+#ifdef _WIN32
+static const char MODEL_PATH_SEPARATOR = ';';
+#else
+static const char MODEL_PATH_SEPARATOR = ':';
+#endif
+
+namespace ModelRegistry {
+    struct Model {
+            std::shared_ptr< ModelPack > pack;
+            bool packInvalid = false;
+            const ModelDescriptor *builtIn = nullptr;
+    };
+
+    struct Index {
+            std::mutex mutex;
+            // Never resized after construction, so indices stay valid and
+            // the keys, which may point into packs, outlive the maps.
+            std::vector< Model > models;
+            std::unordered_map< std::string_view, size_t > byProductString;
+            std::unordered_map< std::string_view, size_t > byName;
+
+            Index() {
+                for (auto &pack : findPacks()) {
+                    auto inserted =
+                        byName.emplace(pack->getName(), models.size());
+                    if (!inserted.second) {
+                        continue; // Shadowed by an earlier directory
+                    }
+                    byProductString.emplace(
+                        pack->getProductString(),
+                        models.size()
+                    );
+                    models.push_back({pack});
+                }
+                for (auto &model : ModelDescriptor::builtIn) {
+                    auto inserted = byName.emplace(model.name, models.size());
+                    if (inserted.second) {
+                        models.emplace_back();
+                    }
+                    auto i = inserted.first->second;
+                    models[i].builtIn = &model;
+                    byProductString.emplace(model.productString, i);
+                }
+            }
+
+            static std::vector< std::string > getSearchPath() {
+                std::vector< std::string > directories;
+                if (auto modelPath = getenv("NUDELTA_MODEL_PATH")) {
+                    std::string_view rest = modelPath;
+                    while (!rest.empty()) {
+                        auto end = rest.find(MODEL_PATH_SEPARATOR);
+                        auto directory = rest.substr(0, end);
+                        if (!directory.empty()) {
+                            directories.emplace_back(directory);
+                        }
+                        if (end == std::string_view::npos) {
+                            break;
+                        }
+                        rest = rest.substr(end + 1);
+                    }
+                }
+#ifdef NUDELTA_MODEL_DIR
+                directories.emplace_back(NUDELTA_MODEL_DIR);
+#endif
+                return directories;
+            }
+
+            static std::vector< std::shared_ptr< ModelPack > > findPacks() {
+                std::vector< std::shared_ptr< ModelPack > > packs;
+                for (auto &directory : getSearchPath()) {
+                    std::error_code error;
+                    std::vector< std::filesystem::path > paths;
+                    auto entries =
+                        std::filesystem::directory_iterator(directory, error);
+                    for (auto &entry : entries) {
+                        if (entry.path().extension() == ".ndmp") {
+                            paths.push_back(entry.path());
+                        }
+                    }
+                    std::sort(paths.begin(), paths.end());
+
+                    for (auto &path : paths) {
+                        try {
+                            packs.push_back(ModelPack::open(path.string()));
+                        } catch (std::runtime_error &e) {
+                            p(stderr,
+                              "[Warning] Skipping model pack: {}\n",
+                              e.what());
+                        }
+                    }
+                }
+                return packs;
+            }
+    };
+
+    static Index &getIndex() {
+        static Index index;
+        return index;
+    }
+
+    static const ModelDescriptor *find(
+        const std::unordered_map< std::string_view, size_t > &map,
+        std::string_view key
+    ) {
+        auto &index = getIndex();
+        std::lock_guard< std::mutex > lock(index.mutex);
+
+        auto it = map.find(key);
+        if (it == map.end()) {
+            return nullptr;
+        }
+        auto &model = index.models[it->second];
+        if (model.pack != nullptr && !model.packInvalid) {
+            try {
+                return &model.pack->getDescriptor();
+            } catch (model_pack_error &e) {
+                p(stderr, "[Warning] Skipping model pack: {}\n", e.what());
+                model.packInvalid = true;
+            }
+        }
+        return model.builtIn;
+    }
+
+    const ModelDescriptor *findByProductString(std::string_view productString) {
+        return find(getIndex().byProductString, productString);
+    }
+
+    const ModelDescriptor *findByName(std::string_view name) {
+        return find(getIndex().byName, name);
+    }
+
+    std::vector< std::string > getNames() {
+        auto &index = getIndex();
+        std::vector< std::string > names;
+        for (auto &model : index.models) {
+            if (model.pack != nullptr) {
+                names.push_back(model.pack->getName());
+            } else {
+                names.emplace_back(model.builtIn->name);
+            }
+        }
+        return names;
+    }
+}
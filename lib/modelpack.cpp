@@ -0,0 +1,220 @@
+/*
+    Nudelta Console
+    Copyright (C) 2022 Mohamed Gaber
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include "modelpack.hpp"
+
+#include "profile.hpp"
+#include "report.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <fmt/core.h>
+
+static const uint8_t MODEL_PACK_MAGIC[] = {'N', 'D', 'M', 'P'};
+static const size_t CHECKSUM_OFFSET = 48;
+static const size_t MODE_SIZE = 32;
+static const size_t INDEX_ENTRY_SIZE = 12;
+
+// Keymap report headers hold the report ID, the command and the region
+static const size_t MIN_REPORT_HEADER_SIZE = 3;
+static const size_t MAX_REPORT_HEADER_SIZE = 8;
+
+// The largest keymap a single report can carry
+static const size_t MAX_KEYMAP_WORDS =
+    (MAX_REPORT_SIZE - MAX_REPORT_HEADER_SIZE) / 4;
+
+static uint64_t checksum(Span< uint8_t > bytes) {
+    auto hash = fnv1a64(bytes.data(), CHECKSUM_OFFSET);
+    return fnv1a64(
+        bytes.data() + ModelPack::HEADER_SIZE,
+        bytes.size() - ModelPack::HEADER_SIZE,
+        hash
+    );
+}
+
+// `count` items of `itemSize` bytes at `offset`, or throws if they do not
+// all lie within `bytes`.
+static const uint8_t *locate(
+    Span< uint8_t > bytes,
+    uint32_t offset,
+    size_t count,
+    size_t itemSize,
+    const char *what
+) {
+    if (offset < ModelPack::HEADER_SIZE || offset > bytes.size()
+        || count > (bytes.size() - offset) / itemSize) {
+        throw model_pack_error(fmt::format("{} lies outside the file.", what));
+    }
+    return bytes.data() + offset;
+}
+
+std::shared_ptr< ModelPack > ModelPack::open(const std::string &path) {
+    std::shared_ptr< MappedFile > mapping = MappedFile::open(path);
+    try {
+        return std::shared_ptr< ModelPack >(new ModelPack(path, mapping));
+    } catch (model_pack_error &e) {
+        throw model_pack_error(fmt::format("'{}': {}", path, e.what()));
+    }
+}
+
+ModelPack::ModelPack(
+    const std::string &path,
+    std::shared_ptr< MappedFile > mapping
+)
+    : path(path), mapping(mapping) {
+    auto bytes = mapping->bytes();
+    auto header = bytes.data();
+    if (bytes.size() < HEADER_SIZE
+        || !std::equal(MODEL_PACK_MAGIC, MODEL_PACK_MAGIC + 4, header)) {
+        throw model_pack_error("Not a model pack.");
+    }
+    auto version = readLE32(header + 4);
+    if (version != VERSION) {
+        throw model_pack_error(
+            fmt::format("Unsupported model pack version {}.", version)
+        );
+    }
+    if (readLE32(header + 8) != HEADER_SIZE) {
+        throw model_pack_error("Unexpected header size.");
+    }
+
+    auto nameBytes = (const char *)header + 16;
+    name = std::string(nameBytes, strnlen(nameBytes, MAX_MODEL_SIZE));
+    if (name.empty()) {
+        throw model_pack_error("The model has no name.");
+    }
+
+    auto productStringSize = readLE32(header + 36);
+    auto productStringBytes = locate(
+        bytes,
+        readLE32(header + 32),
+        productStringSize,
+        1,
+        "The product string"
+    );
+    productString = std::string(
+        (const char *)productStringBytes,
+        productStringSize
+    );
+}
+
+const ModelDescriptor &ModelPack::getDescriptor() {
+    std::lock_guard< std::mutex > lock(mutex);
+    if (!descriptor.has_value()) {
+        try {
+            decode();
+        } catch (model_pack_error &e) {
+            throw model_pack_error(fmt::format("'{}': {}", path, e.what()));
+        }
+    }
+    return descriptor.value();
+}
+
+void ModelPack::decode() {
+    auto bytes = mapping->bytes();
+    auto header = bytes.data();
+    auto expected = uint64_t(readLE32(header + CHECKSUM_OFFSET))
+        | (uint64_t(readLE32(header + CHECKSUM_OFFSET + 4)) << 32);
+    if (checksum(bytes) != expected) {
+        throw model_pack_error("Checksum mismatch; the file is corrupt.");
+    }
+
+    auto words = readLE32(header + 12);
+    if (words == 0 || words > MAX_KEYMAP_WORDS) {
+        throw model_pack_error(fmt::format(
+            "Keymaps must be between 1 and {} words long.",
+            MAX_KEYMAP_WORDS
+        ));
+    }
+
+    ModelDescriptor::Mode modes[2];
+    for (auto mac : {false, true}) {
+        auto &mode = modes[mac];
+        auto modeBytes = locate(
+            bytes,
+            readLE32(header + (mac ? 44 : 40)),
+            1,
+            MODE_SIZE,
+            "A mode"
+        );
+
+        for (auto set : {false, true}) {
+            auto headerSize = readLE32(modeBytes + (set ? 12 : 4));
+            if (headerSize < MIN_REPORT_HEADER_SIZE
+                || headerSize > MAX_REPORT_HEADER_SIZE) {
+                throw model_pack_error(fmt::format(
+                    "Keymap report headers must be between {} and {} bytes long.",
+                    MIN_REPORT_HEADER_SIZE,
+                    MAX_REPORT_HEADER_SIZE
+                ));
+            }
+            auto reportHeader = Span< uint8_t >(
+                locate(
+                    bytes,
+                    readLE32(modeBytes + (set ? 8 : 0)),
+                    headerSize,
+                    1,
+                    "A keymap report header"
+                ),
+                headerSize
+            );
+            (set ? mode.setKeymapHeader : mode.getKeymapHeader) = reportHeader;
+        }
+
+        auto keymapBytes =
+            locate(bytes, readLE32(modeBytes + 16), words, 4, "A keymap");
+        auto &keymap = defaultKeymaps[mac];
+        keymap.resize(words);
+        for (size_t i = 0; i < words; i += 1) {
+            keymap[i] = readLE32(keymapBytes + i * 4);
+        }
+        mode.defaultKeymap = keymap;
+
+        auto indexCount = readLE32(modeBytes + 24);
+        auto indexBytes = locate(
+            bytes,
+            readLE32(modeBytes + 20),
+            indexCount,
+            INDEX_ENTRY_SIZE,
+            "An index table"
+        );
+        auto &indices = indicesByKeyName[mac];
+        indices.resize(indexCount);
+        for (size_t i = 0; i < indexCount; i += 1) {
+            auto entry = indexBytes + i * INDEX_ENTRY_SIZE;
+            auto nameSize = readLE32(entry + 4);
+            auto keyNameBytes =
+                locate(bytes, readLE32(entry), nameSize, 1, "A key name");
+            auto keyName =
+                std::string_view((const char *)keyNameBytes, nameSize);
+            auto index = readLE32(entry + 8);
+            if (index >= words) {
+                throw model_pack_error(fmt::format(
+                    "The index of key '{}' is past the end of the keymap.",
+                    keyName
+                ));
+            }
+            indices[i] = {keyName, index};
+        }
+        // NameTable binary searches, so do not trust the writer to sort
+        std::sort(indices.begin(), indices.end());
+        mode.indicesByKeyName = Span< NameTable::Entry >(indices);
+    }
+
+    descriptor =
+        ModelDescriptor{name, productString, words, modes[0], modes[1]};
+}
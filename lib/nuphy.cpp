@@ -18,44 +18,51 @@
 #include "nuphy.hpp"
 
 #include "access.hpp"
+#include "bank.hpp"
+#include "registry.hpp"
+#include "stats.hpp"
+#include "trace.hpp"
 
 #include <algorithm>
-#include <scope_guard.hpp>
+#include <chrono>
+#include <fmt/format.h>
 #include <sstream>
+#include <thread>
 #include <yaml-cpp/yaml.h>
 
-NuPhy::Handles NuPhy::getHandles() {
-    auto dataHandle = hid_open_path(dataPath.c_str());
-    auto requestHandle = dataHandle;
-    if (requestPath != dataPath) {
-        requestHandle = hid_open_path(requestPath.c_str());
+#ifndef NUDELTA_VERSION
+    #define NUDELTA_VERSION "UNKNOWN"
+#endif
+
+NuPhy::Session::Session(
+    const std::string &dataPath,
+    const std::string &requestPath
+)
+    : dataPath(dataPath), requestPath(requestPath) {
+    auto transport = HIDTransport::get();
+    auto &stats = Stats::get();
+
+    {
+        Trace::Span span("open", "hid", dataPath);
+        Stats::Timer timer(stats.openLatency);
+        stats.opens += 1;
+        data = transport->open(dataPath);
+    }
+    request = data;
+    if (data != nullptr && requestPath != dataPath) {
+        Trace::Span span("open", "hid", requestPath);
+        Stats::Timer timer(stats.openLatency);
+        stats.opens += 1;
+        request = transport->open(requestPath);
     }
 
-    if (dataHandle == nullptr || requestHandle == nullptr) {
+    if (data == nullptr || request == nullptr) {
+        stats.openFailures += 1;
+        // The keyboard may have been unplugged or replaced
+        DeviceRegistry::invalidate();
         throw permissions_error(hidAccessFailureMessage);
     }
 
-    auto cleanup = [](NuPhy::Handles &handles) {
-        if (handles.request != handles.data) {
-            hid_close(handles.request);
-        }
-        hid_close(handles.data);
-    };
-
-    return {dataHandle, requestHandle, dataPath, requestPath, cleanup};
-}
-
-static const size_t MAX_READABLE_SIZE = 0x7FF;
-
-static const uint8_t REQUEST_0[] = {0x05, 0x83, 0xb6, 0x00, 0x00, 0x00};
-static const uint8_t REQUEST_1[] = {0x05, 0x88, 0xb8, 0x00, 0x00, 0x00};
-
-static int get_report(
-    NuPhy::Handles handles,
-    const uint8_t *requestInfo,
-    const size_t requestSize,
-    uint8_t *readBuffer
-) {
     auto hidAccess = checkHIDAccess();
     if (!hidAccess.has_value()) {
         hidAccess = requestHIDAccess();
@@ -63,104 +70,152 @@ static int get_report(
     if (!hidAccess.value()) {
         throw permissions_error(hidAccessFailureMessage);
     }
+}
+
+std::shared_ptr< NuPhy::Session > NuPhy::openSession() {
+    return std::make_shared< Session >(dataPath, requestPath);
+}
 
-    auto bytesWritten =
-        hid_send_feature_report(handles.request, requestInfo, requestSize);
+static const uint8_t REQUEST_0[] = {0x05, 0x83, 0xb6, 0x00, 0x00, 0x00};
+static const uint8_t REQUEST_1[] = {0x05, 0x88, 0xb8, 0x00, 0x00, 0x00};
+
+static const size_t KEYMAP_REPORT_HEADER_SIZE = 8;
+
+// Sends `request`, then reads the reply into the session's report buffer.
+static void get_report(NuPhy::Session &session, Span< uint8_t > request) {
+    auto &stats = Stats::get();
+
+    int bytesWritten;
+    {
+        Trace::Span span("send feature report", "hid", session.requestPath);
+        Stats::Timer timer(stats.sendLatency);
+        bytesWritten =
+            session.request->sendFeatureReport(request.data(), request.size());
+    }
     if (bytesWritten < 0) {
+        stats.reportFailures += 1;
         auto errorString = fmt::format(
             "Failed to write to keyboard: {}",
-            to_utf8(hid_error(handles.request))
+            session.request->getError()
         );
         throw std::runtime_error(errorString);
     } else {
         d("Wrote {} bytes.\n", bytesWritten);
     }
-    readBuffer[0] = 0x06;
-    auto bytesRead =
-        hid_get_feature_report(handles.data, readBuffer, MAX_READABLE_SIZE);
+    stats.reportsSent += 1;
+    stats.bytesWritten += bytesWritten;
+
+    auto &report = session.report;
+    report.data()[0] = 0x06;
+    int bytesRead;
+    {
+        Trace::Span span("get feature report", "hid", session.dataPath);
+        Stats::Timer timer(stats.receiveLatency);
+        bytesRead =
+            session.data->getFeatureReport(report.data(), report.capacity());
+    }
     if (bytesRead < 0) {
+        stats.reportFailures += 1;
+        report.resize(0);
         auto errorString = fmt::format(
             "Failed to read from keyboard: {}",
-            to_utf8(hid_error(handles.data))
+            session.data->getError()
         );
-        throw std::runtime_error("Failed to read from keyboard");
+        throw std::runtime_error(errorString);
     } else {
         d("Read {} bytes.\n", bytesRead);
     }
-
-    return bytesRead;
+    stats.reportsReceived += 1;
+    stats.bytesRead += bytesRead;
+    report.resize(bytesRead);
 }
 
-static std::vector< uint8_t > get_report(
-    NuPhy::Handles handles,
-    const uint8_t *requestInfo,
-    size_t requestSize
-) {
-    uint8_t readBuffer[MAX_READABLE_SIZE];
-
-    auto read = get_report(handles, requestInfo, requestSize, readBuffer);
-
-    return std::vector< uint8_t >(readBuffer, readBuffer + read);
-}
-
-void set_report(NuPhy::Handles handles, uint8_t *data, size_t dataSize) {
-    auto hidAccess = checkHIDAccess();
-    if (!hidAccess.has_value()) {
-        hidAccess = requestHIDAccess();
-    }
-    if (!hidAccess.value()) {
-        throw std::runtime_error(hidAccessFailureMessage);
+// Sends the report in the session's report buffer.
+static void set_report(NuPhy::Session &session) {
+    auto &stats = Stats::get();
+    auto &report = session.report;
+    int bytesWritten;
+    {
+        Trace::Span span("send feature report", "hid", session.dataPath);
+        Stats::Timer timer(stats.sendLatency);
+        bytesWritten =
+            session.data->sendFeatureReport(report.data(), report.size());
     }
-    auto bytesWritten = hid_send_feature_report(handles.data, data, dataSize);
     if (bytesWritten < 0) {
+        stats.reportFailures += 1;
         auto errorString = fmt::format(
             "Failed to write to keyboard: {}",
-            to_utf8(hid_error(handles.request))
+            session.data->getError()
         );
         throw std::runtime_error(errorString);
     } else {
         d("Wrote {} bytes.\n", bytesWritten);
     }
+    stats.reportsSent += 1;
+    stats.bytesWritten += bytesWritten;
 }
 
+// Assumed for keyboards with an unknown product string if `verify` is unset
+static const char *FALLBACK_MODEL = "Air75";
+
 static std::shared_ptr< NuPhy > createKeyboard(
-    std::string name,
+    const std::string &productString,
     std::string dataPath,
     std::string requestPath,
     uint16_t firmware,
     bool verify = true
 ) {
-    if (name == "Air75" || !verify) {
-        return std::make_shared< Air75 >(dataPath, requestPath, firmware);
+    auto model = ModelRegistry::findByProductString(productString);
+    if (model == nullptr && !verify) {
+        model = ModelRegistry::findByName(FALLBACK_MODEL);
     }
-    if (name == "NuPhy Halo75") {
-        return std::make_shared< Halo75 >(dataPath, requestPath, firmware);
+    if (model == nullptr) {
+        return nullptr;
     }
-    return nullptr;
+    return std::make_shared< NuPhy >(*model, dataPath, requestPath, firmware);
 }
 
-std::string represent_hid_struct(hid_device_info *info) {
+std::shared_ptr< NuPhy > NuPhy::forModel(
+    const std::string &model,
+    std::string dataPath,
+    std::string requestPath,
+    uint16_t firmware
+) {
+    auto descriptor = ModelRegistry::findByName(model);
+    if (descriptor == nullptr) {
+        throw unsupported_keyboard(
+            fmt::format("'{}' is not a supported keyboard model.", model)
+        );
+    }
+    return std::make_shared< NuPhy >(
+        *descriptor,
+        dataPath,
+        requestPath,
+        firmware
+    );
+}
+
+std::string represent_hid_struct(const HIDDeviceInfo &info) {
     std::stringstream str;
 
     str << std::hex;
 
-    str << "At path: " << info->path << std::endl;
-    str << "VID/PID: " << info->vendor_id << ":" << info->product_id
+    str << "At path: " << info.path << std::endl;
+    str << "VID/PID: " << info.vendorID << ":" << info.productID
         << std::endl;
-    if (info->serial_number != nullptr) {
-        str << "SN: " << info->serial_number << std::endl;
+    if (info.serialNumber.has_value()) {
+        str << "SN: " << info.serialNumber.value() << std::endl;
     }
-    str << "Release: " << info->release_number << std::endl;
-    if (info->manufacturer_string != nullptr) {
-        str << "Manufacturer String: " << to_utf8(info->manufacturer_string)
+    str << "Release: " << info.releaseNumber << std::endl;
+    if (info.manufacturerString.has_value()) {
+        str << "Manufacturer String: " << info.manufacturerString.value()
             << std::endl;
     }
-    if (info->product_string != nullptr) {
-        str << "Product String: " << to_utf8(info->product_string) << std::endl;
+    if (info.productString.has_value()) {
+        str << "Product String: " << info.productString.value() << std::endl;
     }
-    str << "Usage/Page: " << info->usage << "/" << info->usage_page
-        << std::endl;
-    str << "Interface Number: " << std::dec << info->interface_number
+    str << "Usage/Page: " << info.usage << "/" << info.usagePage << std::endl;
+    str << "Interface Number: " << std::dec << info.interfaceNumber
         << std::endl;
     str << "---" << std::endl;
     return str.str();
@@ -174,25 +229,31 @@ std::string represent_hid_struct(hid_device_info *info) {
 std::string requestCol = "col05";
 std::string dataCol = "col06";
 
-std::shared_ptr< NuPhy > NuPhy::find(bool verify) {
-    auto seeker = hid_enumerate(0x05ac, 0x024f);
-    SCOPE_EXIT {
-        hid_free_enumeration(seeker);
-    };
+// Pairing the request and data collections of more than one keyboard is not
+// yet supported on Windows, so at most one keyboard is returned.
+std::vector< std::shared_ptr< NuPhy > > NuPhy::findAll(bool verify) {
+    Trace::Span span("find keyboards", "hid");
+    std::vector< HIDDeviceInfo > devices;
+    {
+        Stats::Timer timer(Stats::get().enumerateLatency);
+        Stats::get().enumerations += 1;
+        devices = HIDTransport::get()->enumerate(0x05ac, 0x024f);
+    }
 
     uint16_t firmware = 0x0;
+    std::optional< std::string > serialNumber;
     std::string manufacturerString = "";
     std::optional< std::string > productName;
     std::optional< std::string > dataPath;
     std::optional< std::string > requestPath;
 
-    while (seeker != nullptr) {
-        if (seeker->interface_number != -1 && seeker->usage == 1
-            && seeker->usage_page == 0xFF00
+    for (auto &device : devices) {
+        if (device.interfaceNumber != -1 && device.usage == 1
+            && device.usagePage == 0xFF00
             && (!productName.has_value()
-                || productName.value() == to_utf8(seeker->product_string))) {
+                || productName == device.productString)) {
 
-            auto path = std::string(seeker->path);
+            auto path = device.path;
             for (auto it = path.begin(); it != path.end(); it++) {
                 *it = char(std::tolower(*it));
             }
@@ -202,21 +263,21 @@ std::shared_ptr< NuPhy > NuPhy::find(bool verify) {
                         "Multiple keyboards with the same product ID found! Please ensure only one keyboard is plugged in.\n"
                     );
                 }
-                productName = to_utf8(seeker->product_string);
-                requestPath = seeker->path;
-                firmware = seeker->release_number;
-                manufacturerString = to_utf8(seeker->manufacturer_string);
+                productName = device.productString.value_or("");
+                requestPath = device.path;
+                firmware = device.releaseNumber;
+                serialNumber = device.serialNumber;
+                manufacturerString = device.manufacturerString.value_or("");
             } else if (path.find(dataCol) != -1) {
                 if (dataPath.has_value()) {
                     throw std::runtime_error(
                         "Multiple keyboards with the same product ID found! Please ensure only one keyboard is plugged in.\n"
                     );
                 }
-                productName = to_utf8(seeker->product_string);
-                dataPath = seeker->path;
+                productName = device.productString.value_or("");
+                dataPath = device.path;
             }
         }
-        seeker = seeker->next;
     }
 
     if (dataPath.has_value() && requestPath.has_value()) {
@@ -234,277 +295,725 @@ std::shared_ptr< NuPhy > NuPhy::find(bool verify) {
                 productName.value()
             ));
         }
-        return keyboard;
+        keyboard->serialNumber = serialNumber;
+        return {keyboard};
     }
 
-    return nullptr;
+    return {};
 }
 #else
-std::shared_ptr< NuPhy > NuPhy::find(bool verify) {
-    std::shared_ptr< NuPhy > keyboard;
-
-    auto seeker = hid_enumerate(0x05ac, 0x024f);
-    SCOPE_EXIT {
-        hid_free_enumeration(seeker);
-    };
+std::vector< std::shared_ptr< NuPhy > > NuPhy::findAll(bool verify) {
+    std::vector< std::shared_ptr< NuPhy > > keyboards;
+
+    Trace::Span span("find keyboards", "hid");
+    std::vector< HIDDeviceInfo > devices;
+    {
+        Stats::Timer timer(Stats::get().enumerateLatency);
+        Stats::get().enumerations += 1;
+        devices = HIDTransport::get()->enumerate(0x05ac, 0x024f);
+    }
 
     bool unsupportedDetected = false;
-    bool multipleWarned = false;
+    std::vector< std::string > seenPaths;
     std::string productString = "";
-    while (seeker != nullptr) {
-        if (seeker->interface_number != -1 && seeker->usage == 1
-            && seeker->usage_page == 0xFF00) {
-            if (keyboard != nullptr) {
-                // We only care if the path is different, because that means a
-                // different device on Mac and Linux
-                if (keyboard->dataPath != std::string(seeker->path)) {
-                    if (!multipleWarned) {
-                        p(stderr,
-                          "[Warning] Multiple NuPhy keyboards found! Please keep only one plugged in. Only the first matched device will be used.\n"
-                        );
-                        multipleWarned = true;
-                    }
-                }
-            } else {
-                if (seeker->product_string == nullptr) {
+    for (auto &device : devices) {
+        if (device.interfaceNumber != -1 && device.usage == 1
+            && device.usagePage == 0xFF00) {
+            // We only care if the path is different, because that means a
+            // different device on Mac and Linux
+            auto &path = device.path;
+            if (std::find(seenPaths.begin(), seenPaths.end(), path)
+                == seenPaths.end()) {
+                seenPaths.push_back(path);
+
+                if (!device.productString.has_value()) {
                     throw permissions_error(hidAccessFailureMessage);
                 }
-                auto productName = to_utf8(seeker->product_string);
+                auto productName = device.productString.value();
                 productString = productName;
-                if (auto manufacturerStringW = seeker->manufacturer_string) {
+                if (device.manufacturerString.has_value()) {
                     // There is no manufacturerString on the Linux/libusb
                     // implementation.
-                    auto manufacturerName = to_utf8(manufacturerStringW);
-                    productString =
-                        fmt::format("{} {}", manufacturerName, productName);
+                    productString = fmt::format(
+                        "{} {}",
+                        device.manufacturerString.value(),
+                        productName
+                    );
                 }
-                keyboard = createKeyboard(
+                auto keyboard = createKeyboard(
                     productName,
-                    seeker->path,
-                    seeker->path,
-                    seeker->release_number,
+                    path,
+                    path,
+                    device.releaseNumber,
                     verify
                 );
                 if (keyboard == nullptr) {
                     unsupportedDetected = true;
+                } else {
+                    keyboard->serialNumber = device.serialNumber;
+                    keyboards.push_back(keyboard);
                 }
             }
         }
-        seeker = seeker->next;
     }
 
-    if (keyboard == nullptr && unsupportedDetected) {
+    if (keyboards.empty() && unsupportedDetected) {
         throw unsupported_keyboard(fmt::format(
             "No supported keyboards found, but a similar keyboard, '{}', has been found.\n\nIf you believe this keyboard not being supported is an error, please file a bug report.",
             productString
         ));
     }
 
-    return keyboard;
+    return keyboards;
 }
 #endif
 
-std::vector< uint32_t > NuPhy::getKeymap(bool mac) {
-    auto handles = getHandles();
-    SCOPE_EXIT {
-        handles.cleanup(handles);
-    };
+std::shared_ptr< NuPhy > NuPhy::find(bool verify) {
+    auto keyboards = findAll(verify);
+    if (keyboards.empty()) {
+        return nullptr;
+    }
+    if (keyboards.size() > 1) {
+        p(stderr,
+          "[Warning] Multiple NuPhy keyboards found! Please keep only one plugged in. Only the first matched device will be used.\n"
+        );
+    }
+    return keyboards[0];
+}
 
-    auto requestHeader = getKeymapReportHeader(mac);
+LE32View NuPhy::readKeymap(bool mac, Session &session) {
+    Trace::Span span("read keymap", "keymap", dataPath, mac ? "Mac" : "Win");
+    get_report(session, getKeymapReportHeader(mac));
+    return session.report.words(KEYMAP_REPORT_HEADER_SIZE);
+}
 
-    auto keymapReport =
-        get_report(handles, requestHeader.data(), requestHeader.size());
-    // ALERT: Endianness-defined Behavior
-    auto *start_pointer = (uint32_t *)&keymapReport[8];
-    auto *end_pointer = (uint32_t *)(keymapReport.data() + keymapReport.size());
+std::vector< uint32_t >
+NuPhy::getKeymap(bool mac, std::shared_ptr< Session > session) {
+    if (session == nullptr) {
+        session = openSession();
+    }
 
-    return std::vector< uint32_t >(start_pointer, end_pointer);
+    return readKeymap(mac, *session).toVector();
 }
 
-void NuPhy::setKeymap(const std::vector< uint32_t > &keymap, bool mac) {
-    auto handles = getHandles();
-    SCOPE_EXIT {
-        handles.cleanup(handles);
-    };
+static void encodeKeymapReport(
+    ReportBuffer &report,
+    Span< uint8_t > header,
+    Span< uint32_t > keymap
+) {
+    size_t count = header.size() + (keymap.size() * 4);
+    if (count > report.capacity()) {
+        throw std::runtime_error(fmt::format(
+            "A keymap of {} keys does not fit in a single report.",
+            keymap.size()
+        ));
+    }
 
-    auto header = setKeymapReportHeader(mac);
+    auto cursor = std::copy(header.begin(), header.end(), report.data());
+    for (auto word : keymap) {
+        writeLE32(cursor, word);
+        cursor += 4;
+    }
+    report.resize(count);
+}
 
-    size_t count = header.size() + (keymap.size() * 4);
+static std::vector< size_t >
+findMismatches(Span< uint32_t > expected, LE32View actual) {
+    std::vector< size_t > mismatches;
+    for (size_t i = 0; i < expected.size(); i += 1) {
+        if (i >= actual.size() || actual[i] != expected[i]) {
+            mismatches.push_back(i);
+        }
+    }
+    return mismatches;
+}
 
-    uint8_t *buffer = new uint8_t[count];
-    SCOPE_EXIT {
-        delete[] buffer;
-    };
+// Attempts, including the first write. The backoff doubles after each.
+static const int MAX_WRITE_ATTEMPTS = 4;
+static const auto INITIAL_WRITE_BACKOFF = std::chrono::milliseconds(20);
 
-    // ALERT: Endianness-defined Behavior
-    auto *start_pointer = (uint8_t *)keymap.data();
-    auto *end_pointer = (uint8_t *)(keymap.data() + keymap.size());
+void NuPhy::setKeymap(
+    Span< uint32_t > keymap,
+    bool mac,
+    std::shared_ptr< Session > session,
+    bool verify
+) {
+    if (session == nullptr) {
+        session = openSession();
+    }
 
-    std::copy(header.data(), header.data() + header.size(), buffer);
-    std::copy(start_pointer, end_pointer, buffer + header.size());
+    Trace::Span span("write keymap", "keymap", dataPath, mac ? "Mac" : "Win");
+    auto header = setKeymapReportHeader(mac);
+    auto backoff = INITIAL_WRITE_BACKOFF;
+    for (int attempt = 1;; attempt += 1) {
+        // Re-encoded every attempt, as reading back reuses the same buffer
+        encodeKeymapReport(session->report, header, keymap);
+        set_report(*session);
+        if (!verify) {
+            return;
+        }
 
-    set_report(handles, buffer, count);
+        auto mismatches = findMismatches(keymap, readKeymap(mac, *session));
+        if (mismatches.empty()) {
+            return;
+        }
+        if (attempt == MAX_WRITE_ATTEMPTS) {
+            Stats::get().verificationFailures += 1;
+            throw write_verification_error(
+                fmt::format(
+                    "The keyboard's {} mode did not read back as written after {} attempts. Mismatched indices: [{}].",
+                    mac ? "Mac" : "Windows",
+                    MAX_WRITE_ATTEMPTS,
+                    fmt::join(mismatches, ", ")
+                ),
+                mac,
+                mismatches
+            );
+        }
+        d("Readback mismatched at {} indices, retrying.\n", mismatches.size());
+        Stats::get().writeRetries += 1;
+        std::this_thread::sleep_for(backoff);
+        backoff *= 2;
+    }
 }
 
 const char *TOP_LEVEL_WIN = "keys";
 const char *TOP_LEVEL_MAC = "mackeys";
 
-void NuPhy::validateYAMLKeymap(
-    const std::string &yamlString,
+static NuPhy::Diagnostic
+diagnosticAt(const YAML::Mark &mark, const std::string &message) {
+    if (mark.is_null()) {
+        return {message, 0, 0};
+    }
+    return {message, mark.line + 1, mark.column + 1};
+}
+
+void NuPhy::validateYAMLEntry(
+    const YAML::Node &key,
+    const YAML::Node &codeObject,
     bool rawOk,
-    bool mac
+    bool mac,
+    std::vector< Diagnostic > &diagnostics
 ) {
-    auto config = YAML::Load(yamlString);
-
-    auto keycodes = getKeycodesByKeyName();
-    auto modifiersByName = getModifiersByModifierName();
-    auto writableKeymap = getDefaultKeymap(mac);
-    auto indices = getIndicesByKeyName(mac);
+    auto &keycodes = getKeycodesByKeyName();
+    auto &modifiersByName = getModifiersByModifierName();
+    auto &indices = getIndicesByKeyName(mac);
 
     auto topLevelKey = mac ? TOP_LEVEL_MAC : TOP_LEVEL_WIN;
 
-    auto keys = config[topLevelKey];
-
-    if (keys.Type() != YAML::NodeType::Map && !keys.IsNull()
-        && keys.IsDefined()) {
-        auto errorMessage =
-            fmt::format("Invalid config file: '{}' is not a map.", topLevelKey);
-        throw std::runtime_error(errorMessage);
-    }
-
-    if (keys.IsNull() || !keys.IsDefined()) {
+    if (!key.IsScalar()) {
+        diagnostics.push_back(diagnosticAt(
+            key.Mark(),
+            fmt::format(
+                "Invalid config in {}: keys must be names.",
+                topLevelKey
+            )
+        ));
         return;
     }
+    auto keyID = key.as< std::string >();
+
+    if (indices.find(keyID) == indices.end()) {
+        auto errorMessage = fmt::format(
+            "Invalid config in {}: a key for '{}' does not exist in '{}' mode.",
+            topLevelKey,
+            keyID,
+            mac ? "Mac" : "Windows"
+        );
+        diagnostics.push_back(diagnosticAt(key.Mark(), errorMessage));
+    }
 
-    for (auto entry : keys) {
-        auto keyID = entry.first.as< std::string >();
-
-        if (indices.find(keyID) == indices.end()) {
-            auto errorMessage = fmt::format(
-                "Invalid config in {}: a key for '{}' does not exist in '{}' mode.",
+    if (!codeObject.IsScalar() && !codeObject.IsMap()) {
+        diagnostics.push_back(diagnosticAt(
+            codeObject.Mark(),
+            fmt::format(
+                "Invalid config in {}.{}: expected a key name or a map.",
                 topLevelKey,
-                keyID,
-                mac ? "Mac" : "Windows"
-            );
-            throw std::runtime_error(errorMessage);
-        }
-
-        auto codeObject = entry.second;
-        if (entry.second.IsScalar()) {
-            auto codeID = codeObject.as< std::string >();
-            codeObject = YAML::Node();
-            codeObject["key"] = codeID;
-        }
+                keyID
+            )
+        ));
+        return;
+    }
 
-        // If "raw" exists: just set it and ignore everything else
+    // If "raw" exists: just set it and ignore everything else
+    if (codeObject.IsMap()) {
         auto raw = codeObject["raw"];
         if (raw.IsDefined() && !raw.IsNull()) {
+            uint32_t rawValue;
             if (!rawOk) {
                 auto errorMessage = fmt::format(
                     "Invalid config in {}.{}: raw configurations are not supported by the Nudelta GUI.",
                     topLevelKey,
                     keyID
                 );
-                throw std::runtime_error(errorMessage);
+                diagnostics.push_back(diagnosticAt(raw.Mark(), errorMessage));
+            } else if (!YAML::convert< uint32_t >::decode(raw, rawValue)) {
+                diagnostics.push_back(diagnosticAt(
+                    raw.Mark(),
+                    fmt::format(
+                        "Invalid config in {}.{}: raw is not a 32-bit unsigned integer.",
+                        topLevelKey,
+                        keyID
+                    )
+                ));
             }
-            continue;
+            return;
         }
+    }
 
-        auto codeID = codeObject["key"].as< std::string >();
-        if (keycodes.find(codeID) == keycodes.end()) {
-            auto errorMessage = fmt::format(
-                "Invalid config in {}.{}: a code for key '{}' was not found.",
+    auto code = codeObject.IsScalar() ? codeObject : codeObject["key"];
+    if (!code.IsDefined() || !code.IsScalar()) {
+        diagnostics.push_back(diagnosticAt(
+            codeObject.Mark(),
+            fmt::format(
+                "Invalid config in {}.{}: no key name was given.",
                 topLevelKey,
-                keyID,
-                codeID
-            );
-            throw std::runtime_error(errorMessage);
-        }
+                keyID
+            )
+        ));
+        return;
+    }
+    auto codeID = code.as< std::string >();
+    if (keycodes.find(codeID) == keycodes.end()) {
+        auto errorMessage = fmt::format(
+            "Invalid config in {}.{}: a code for key '{}' was not found.",
+            topLevelKey,
+            keyID,
+            codeID
+        );
+        diagnostics.push_back(diagnosticAt(code.Mark(), errorMessage));
+    }
 
-        auto modifiers = codeObject["modifiers"];
-        if (modifiers.IsDefined() && !modifiers.IsNull()) {
-            if (modifiers.Type() != YAML::NodeType::Sequence) {
-                throw std::runtime_error(fmt::format(
+    if (!codeObject.IsMap()) {
+        return;
+    }
+    auto modifiers = codeObject["modifiers"];
+    if (modifiers.IsDefined() && !modifiers.IsNull()) {
+        if (modifiers.Type() != YAML::NodeType::Sequence) {
+            diagnostics.push_back(diagnosticAt(
+                modifiers.Mark(),
+                fmt::format(
                     "Invalid config in {}.{}: modifiers is not an array.",
                     topLevelKey,
                     keyID
-                ));
-            }
-            for (auto modifier : modifiers) {
-                auto modifierName = modifier.as< std::string >();
-                auto modifierIt = modifiersByName.find(modifierName);
-                if (modifierIt == modifiersByName.end()) {
-                    throw std::runtime_error(fmt::format(
+                )
+            ));
+            return;
+        }
+        for (auto modifier : modifiers) {
+            auto modifierName =
+                modifier.IsScalar() ? modifier.as< std::string >() : "";
+            auto modifierIt = modifiersByName.find(modifierName);
+            if (modifierIt == modifiersByName.end()) {
+                diagnostics.push_back(diagnosticAt(
+                    modifier.Mark(),
+                    fmt::format(
                         "Invalid config in {}.{}: Unknown modifier {}: make sure you're not adding a direction, e.g. lalt instead of alt",
                         topLevelKey,
                         keyID,
                         modifierName
-                    ));
-                }
+                    )
+                ));
             }
         }
     }
 }
 
-void NuPhy::setKeymapFromYAML(const std::string &yamlString) {
-    validateYAMLKeymap(yamlString, true, false);
-    validateYAMLKeymap(yamlString, true, true);
+// Appends every problem found in one mode of `config` to `diagnostics`.
+static void validateConfig(
+    NuPhy &keyboard,
+    const YAML::Node &config,
+    bool rawOk,
+    bool mac,
+    std::vector< NuPhy::Diagnostic > &diagnostics
+) {
+    auto topLevelKey = mac ? TOP_LEVEL_MAC : TOP_LEVEL_WIN;
 
-    auto config = YAML::Load(yamlString);
+    auto keys = config[topLevelKey];
 
-    auto keycodes = getKeycodesByKeyName();
-    auto modifiersByName = getModifiersByModifierName();
+    // A missing section is not a valid node, whose type cannot be asked for
+    if (!keys.IsDefined() || keys.IsNull()) {
+        return;
+    }
 
-    for (auto mac : {true, false}) {
-        auto writableKeymap = getDefaultKeymap(mac);
-        auto indices = getIndicesByKeyName(mac);
+    if (keys.Type() != YAML::NodeType::Map) {
+        auto errorMessage =
+            fmt::format("Invalid config file: '{}' is not a map.", topLevelKey);
+        diagnostics.push_back(diagnosticAt(keys.Mark(), errorMessage));
+        return;
+    }
 
-        auto topLevelKey = mac ? TOP_LEVEL_MAC : TOP_LEVEL_WIN;
-        auto keys = config[topLevelKey];
+    for (auto entry : keys) {
+        keyboard.validateYAMLEntry(
+            entry.first,
+            entry.second,
+            rawOk,
+            mac,
+            diagnostics
+        );
+    }
+}
 
-        if (!keys.IsNull() && keys.IsDefined()) {
-            for (auto entry : keys) {
-                auto keyID = entry.first.as< std::string >();
+static std::optional< YAML::Node > parseConfig(
+    const std::string &yamlString,
+    std::vector< NuPhy::Diagnostic > &diagnostics
+) {
+    Trace::Span span("parse YAML", "profile");
+    Stats::Timer timer(Stats::get().parseLatency);
+    try {
+        return YAML::Load(yamlString);
+    } catch (YAML::ParserException &e) {
+        diagnostics.push_back(diagnosticAt(e.mark, e.msg));
+        return std::nullopt;
+    }
+}
 
-                auto keyIt = indices.find(keyID);
-                auto key = keyIt->second;
+static void throwFirst(const std::vector< NuPhy::Diagnostic > &diagnostics) {
+    if (!diagnostics.empty()) {
+        throw std::runtime_error(diagnostics.front().message);
+    }
+}
 
-                auto codeObject = entry.second;
-                if (entry.second.IsScalar()) {
-                    auto codeID = codeObject.as< std::string >();
-                    codeObject = YAML::Node();
-                    codeObject["key"] = codeID;
-                }
+std::vector< NuPhy::Diagnostic >
+NuPhy::diagnoseYAMLKeymap(const std::string &yamlString, bool rawOk) {
+    std::vector< Diagnostic > diagnostics;
+    auto config = parseConfig(yamlString, diagnostics);
+    if (config.has_value()) {
+        Trace::Span span("validate", "profile");
+        validateConfig(*this, config.value(), rawOk, false, diagnostics);
+        validateConfig(*this, config.value(), rawOk, true, diagnostics);
+    }
+    return diagnostics;
+}
 
-                // If "raw" exists: just set it and ignore everything else
-                auto raw = codeObject["raw"];
-                if (raw.IsDefined() && !raw.IsNull()) {
-                    writableKeymap[key] = raw.as< uint32_t >();
-                    continue;
-                }
+void NuPhy::validateYAMLKeymap(
+    const std::string &yamlString,
+    bool rawOk,
+    bool mac
+) {
+    std::vector< Diagnostic > diagnostics;
+    auto config = parseConfig(yamlString, diagnostics);
+    if (config.has_value()) {
+        Trace::Span span("validate", "profile");
+        validateConfig(*this, config.value(), rawOk, mac, diagnostics);
+    }
+    throwFirst(diagnostics);
+}
+
+NuPhy::KeymapDiff NuPhy::applyKeymap(
+    Span< uint32_t > keymap,
+    bool mac,
+    std::shared_ptr< Session > session,
+    bool force,
+    bool verify
+) {
+    if (session == nullptr) {
+        session = openSession();
+    }
+
+    KeymapDiff diff = {mac, {}, false, false};
+
+    // Compared in place: the read is not copied out of the report buffer
+    diff.changedIndices = findMismatches(keymap, readKeymap(mac, *session));
+
+    if (force || !diff.changedIndices.empty()) {
+        setKeymap(keymap, mac, session, verify);
+        diff.written = true;
+        diff.verified = verify;
+    }
+
+    return diff;
+}
+
+std::string
+NuPhy::describeDiffs(const std::vector< NuPhy::KeymapDiff > &diffs) {
+    std::vector< std::string > descriptions;
+    for (auto &diff : diffs) {
+        auto mode = diff.mac ? "Mac" : "Windows";
+        if (!diff.written) {
+            descriptions.push_back(
+                fmt::format("{} mode unchanged, write skipped", mode)
+            );
+        } else {
+            descriptions.push_back(fmt::format(
+                "{} mode written{} ({} changed: [{}])",
+                mode,
+                diff.verified ? " and verified" : "",
+                diff.changedIndices.size(),
+                fmt::join(diff.changedIndices, ", ")
+            ));
+        }
+    }
+    return fmt::format("{}", fmt::join(descriptions, "; "));
+}
+
+std::vector< std::string >
+NuPhy::annotateKeymap(Span< uint32_t > keymap, bool mac) {
+    // Tables are sorted by name, so aliases resolve to the first in order
+    std::unordered_map< uint32_t, std::string_view > keyNamesByIndex;
+    for (auto &[name, index] : getIndicesByKeyName(mac)) {
+        keyNamesByIndex.emplace(index, name);
+    }
+    std::unordered_map< uint32_t, std::string_view > keyNamesByKeycode;
+    for (auto &[name, keycode] : getKeycodesByKeyName()) {
+        keyNamesByKeycode.emplace(keycode, name);
+    }
+    auto &modifiers = getModifiersByModifierName();
+    uint32_t modifierMask = 0;
+    for (auto &modifier : modifiers) {
+        modifierMask |= modifier.second;
+    }
 
-                auto codeID = codeObject["key"].as< std::string >();
-                auto codeIt = keycodes.find(codeID);
-
-                auto code = codeIt->second;
-                auto modifiers = codeObject["modifiers"];
-                if (modifiers.IsDefined() && !modifiers.IsNull()) {
-                    for (auto modifier : modifiers) {
-                        auto modifierName = modifier.as< std::string >();
-                        auto modifierIt = modifiersByName.find(modifierName);
-                        auto modifierCode = modifierIt->second;
-                        code |= modifierCode;
+    std::vector< std::string > annotations(keymap.size());
+    for (uint32_t i = 0; i < keymap.size(); i += 1) {
+        auto word = keymap[i];
+
+        std::string keycode;
+        auto keycodeIt = keyNamesByKeycode.find(word);
+        if (keycodeIt == keyNamesByKeycode.end()) {
+            keycodeIt = keyNamesByKeycode.find(word & ~modifierMask);
+            if (keycodeIt != keyNamesByKeycode.end()) {
+                for (auto &[name, bit] : modifiers) {
+                    if ((word & bit) != 0) {
+                        keycode.append(name);
+                        keycode.push_back('+');
                     }
                 }
-                writableKeymap[key] = code;
             }
         }
+        if (keycodeIt != keyNamesByKeycode.end()) {
+            keycode.append(keycodeIt->second);
+        }
+
+        auto &annotation = annotations[i];
+        auto keyIt = keyNamesByIndex.find(i);
+        if (keyIt != keyNamesByIndex.end()) {
+            annotation.append(keyIt->second);
+        }
+        if (!keycode.empty()) {
+            annotation.append(annotation.empty() ? "-> " : " -> ");
+            annotation.append(keycode);
+        }
+    }
+    return annotations;
+}
+
+static std::vector< uint32_t >
+compileConfig(NuPhy &keyboard, const YAML::Node &config, bool mac) {
+    auto &keycodes = keyboard.getKeycodesByKeyName();
+    auto &modifiersByName = keyboard.getModifiersByModifierName();
+
+    auto defaultKeymap = keyboard.getDefaultKeymap(mac);
+    auto writableKeymap =
+        std::vector< uint32_t >(defaultKeymap.begin(), defaultKeymap.end());
+    auto &indices = keyboard.getIndicesByKeyName(mac);
+
+    auto topLevelKey = mac ? TOP_LEVEL_MAC : TOP_LEVEL_WIN;
+    auto keys = config[topLevelKey];
+
+    if (keys.IsDefined() && !keys.IsNull()) {
+        for (auto entry : keys) {
+            auto keyID = entry.first.as< std::string >();
+
+            auto keyIt = indices.find(keyID);
+            auto key = keyIt->second;
+
+            auto codeObject = entry.second;
+            if (entry.second.IsScalar()) {
+                auto codeID = codeObject.as< std::string >();
+                codeObject = YAML::Node();
+                codeObject["key"] = codeID;
+            }
+
+            // If "raw" exists: just set it and ignore everything else
+            auto raw = codeObject["raw"];
+            if (raw.IsDefined() && !raw.IsNull()) {
+                writableKeymap[key] = raw.as< uint32_t >();
+                continue;
+            }
+
+            auto codeID = codeObject["key"].as< std::string >();
+            auto codeIt = keycodes.find(codeID);
+
+            auto code = codeIt->second;
+            auto modifiers = codeObject["modifiers"];
+            if (modifiers.IsDefined() && !modifiers.IsNull()) {
+                for (auto modifier : modifiers) {
+                    auto modifierName = modifier.as< std::string >();
+                    auto modifierIt = modifiersByName.find(modifierName);
+                    auto modifierCode = modifierIt->second;
+                    code |= modifierCode;
+                }
+            }
+            writableKeymap[key] = code;
+        }
+    }
+
+    return writableKeymap;
+}
+
+static uint64_t hashTable(uint64_t hash, const NameTable &table) {
+    for (auto &entry : table) {
+        hash = fnv1a64(entry.first.data(), entry.first.size(), hash);
+        hash = fnv1a64(&entry.second, sizeof entry.second, hash);
+    }
+    return hash;
+}
+
+// Covers everything a compiled profile depends on besides the YAML itself,
+// so a cache entry is never reused after the resource tables change.
+static uint64_t
+hashProfileSource(NuPhy &keyboard, const std::string &yamlString) {
+    auto hash = fnv1a64(yamlString.data(), yamlString.size());
+
+    auto name = keyboard.getName();
+    hash = fnv1a64(name.data(), name.size() + 1, hash);
+    hash = fnv1a64(NUDELTA_VERSION, sizeof NUDELTA_VERSION, hash);
+
+    hash = hashTable(hash, keyboard.getKeycodesByKeyName());
+    hash = hashTable(hash, keyboard.getModifiersByModifierName());
+    for (auto mac : {false, true}) {
+        auto defaultKeymap = keyboard.getDefaultKeymap(mac);
+        hash = fnv1a64(
+            defaultKeymap.data(),
+            defaultKeymap.size() * sizeof(uint32_t),
+            hash
+        );
+        hash = hashTable(hash, keyboard.getIndicesByKeyName(mac));
+    }
+
+    return hash;
+}
+
+CompiledProfile
+NuPhy::compileYAMLKeymap(const std::string &yamlString, bool useCache) {
+    Trace::Span span("compile profile", "profile");
+
+    std::optional< uint64_t > cacheKey;
+    if (useCache) {
+        Trace::Span span("cache lookup", "profile");
+        cacheKey = hashProfileSource(*this, yamlString);
+        auto cached = ProfileCache::load(cacheKey.value());
+        if (cached.has_value() && cached->model == getName()) {
+            Stats::get().cacheHits += 1;
+            return cached.value();
+        }
+        Stats::get().cacheMisses += 1;
+    }
+
+    Stats::Timer timer(Stats::get().compileLatency);
+
+    std::vector< Diagnostic > diagnostics;
+    auto config = parseConfig(yamlString, diagnostics);
+    throwFirst(diagnostics);
+    {
+        Trace::Span span("validate", "profile");
+        validateConfig(*this, config.value(), true, false, diagnostics);
+        validateConfig(*this, config.value(), true, true, diagnostics);
+    }
+    throwFirst(diagnostics);
+
+    CompiledProfile profile;
+    {
+        Trace::Span span("resolve", "profile");
+        profile = {
+            getName(),
+            compileConfig(*this, config.value(), false),
+            compileConfig(*this, config.value(), true),
+        };
+    }
 
-        setKeymap(writableKeymap, mac);
+    if (cacheKey.has_value()) {
+        Trace::Span span("cache store", "profile");
+        ProfileCache::store(cacheKey.value(), profile);
     }
+    Stats::get().profilesCompiled += 1;
+
+    return profile;
+}
+
+std::vector< NuPhy::KeymapDiff > NuPhy::setKeymapFromProfile(
+    const CompiledProfile &profile,
+    std::shared_ptr< Session > session,
+    bool force,
+    bool verify
+) {
+    if (profile.model != getName()) {
+        throw std::runtime_error(fmt::format(
+            "The profile was compiled for a NuPhy {}, but the keyboard is a NuPhy {}.",
+            profile.model,
+            getName()
+        ));
+    }
+
+    if (session == nullptr) {
+        session = openSession();
+    }
+
+    std::vector< KeymapDiff > diffs;
+    for (auto mac : {true, false}) {
+        diffs.push_back(
+            applyKeymap(profile.getKeymap(mac), mac, session, force, verify)
+        );
+    }
+    return diffs;
+}
+
+std::vector< NuPhy::KeymapDiff > NuPhy::setKeymapFromYAML(
+    const std::string &yamlString,
+    std::shared_ptr< Session > session,
+    bool force,
+    bool verify
+) {
+    return setKeymapFromProfile(
+        compileYAMLKeymap(yamlString),
+        session,
+        force,
+        verify
+    );
 }
 
-void NuPhy::resetKeymap() {
-    setKeymap(getDefaultKeymap(false), false);
-    setKeymap(getDefaultKeymap(true), true);
+std::vector< NuPhy::KeymapDiff > NuPhy::setKeymapFromBank(
+    const ProfileBank &bank,
+    const std::string &name,
+    std::shared_ptr< Session > session,
+    bool force,
+    bool verify
+) {
+    auto file = bank.find(name, getName());
+    if (file == nullptr) {
+        throw std::runtime_error(fmt::format(
+            "The bank holds no profile named '{}' for the NuPhy {}.",
+            name,
+            getName()
+        ));
+    }
+
+    if (session == nullptr) {
+        session = openSession();
+    }
+
+    std::vector< KeymapDiff > diffs;
+    for (auto mac : {true, false}) {
+        auto keymap = file->getKeymap(mac).toVector();
+        diffs.push_back(applyKeymap(keymap, mac, session, force, verify));
+    }
+    return diffs;
+}
+
+std::vector< NuPhy::KeymapDiff > NuPhy::resetKeymap(
+    std::shared_ptr< Session > session,
+    bool force,
+    bool verify
+) {
+    if (session == nullptr) {
+        session = openSession();
+    }
+    std::vector< KeymapDiff > diffs;
+    for (auto mac : {false, true}) {
+        diffs.push_back(
+            applyKeymap(getDefaultKeymap(mac), mac, session, force, verify)
+        );
+    }
+    return diffs;
 }
\ No newline at end of file
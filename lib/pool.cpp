@@ -0,0 +1,73 @@
+/*
+    Nudelta Console
+    Copyright (C) 2022 Mohamed Gaber
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include "pool.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+void parallelFor(
+    size_t count,
+    const std::function< void(size_t) > &job,
+    size_t maxWorkers
+) {
+    if (maxWorkers == 0) {
+        maxWorkers = std::max(std::thread::hardware_concurrency(), 1u);
+    }
+    auto workerCount = std::min(count, maxWorkers);
+
+    if (workerCount <= 1) {
+        for (size_t i = 0; i < count; i += 1) {
+            job(i);
+        }
+        return;
+    }
+
+    std::atomic< size_t > next = 0;
+    std::exception_ptr firstError;
+    std::mutex errorMutex;
+
+    auto worker = [&]() {
+        for (auto i = next++; i < count; i = next++) {
+            try {
+                job(i);
+            } catch (...) {
+                std::lock_guard< std::mutex > lock(errorMutex);
+                if (!firstError) {
+                    firstError = std::current_exception();
+                }
+            }
+        }
+    };
+
+    std::vector< std::thread > workers;
+    workers.reserve(workerCount);
+    for (size_t i = 0; i < workerCount; i += 1) {
+        workers.emplace_back(worker);
+    }
+    for (auto &thread : workers) {
+        thread.join();
+    }
+
+    if (firstError) {
+        std::rethrow_exception(firstError);
+    }
+}
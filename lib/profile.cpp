@@ -0,0 +1,124 @@
+/*
+    Nudelta Console
+    Copyright (C) 2022 Mohamed Gaber
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include "profile.hpp"
+
+#include "keymapfile.hpp"
+
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+
+uint64_t fnv1a64(const void *data, size_t size, uint64_t hash) {
+    auto bytes = (const uint8_t *)data;
+    for (size_t i = 0; i < size; i += 1) {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3;
+    }
+    return hash;
+}
+
+namespace ProfileCache {
+    std::optional< std::string > getDirectory() {
+        if (auto override = getenv("NUDELTA_CACHE_DIR")) {
+            if (*override == '\0') {
+                return std::nullopt;
+            }
+            return override;
+        }
+#if defined(_WIN32)
+        if (auto localAppData = getenv("LOCALAPPDATA")) {
+            return fmt::format("{}\\nudelta", localAppData);
+        }
+#elif defined(__APPLE__)
+        if (auto home = getenv("HOME")) {
+            return fmt::format("{}/Library/Caches/nudelta", home);
+        }
+#else
+        if (auto xdgCache = getenv("XDG_CACHE_HOME")) {
+            return fmt::format("{}/nudelta", xdgCache);
+        }
+        if (auto home = getenv("HOME")) {
+            return fmt::format("{}/.cache/nudelta", home);
+        }
+#endif
+        return std::nullopt;
+    }
+
+    static std::optional< std::filesystem::path > getPath(uint64_t key) {
+        auto directory = getDirectory();
+        if (!directory.has_value()) {
+            return std::nullopt;
+        }
+        return std::filesystem::path(directory.value())
+            / fmt::format("{:016x}.ndk", key);
+    }
+
+    std::optional< CompiledProfile > load(uint64_t key) {
+        auto path = getPath(key);
+        if (!path.has_value()) {
+            return std::nullopt;
+        }
+
+        try {
+            auto file = KeymapFile::open(path->string());
+            if (file->isRaw()) {
+                return std::nullopt;
+            }
+            return file->toProfile();
+        } catch (std::runtime_error &) {
+            return std::nullopt;
+        }
+    }
+
+    void store(uint64_t key, const CompiledProfile &profile) {
+        auto path = getPath(key);
+        if (!path.has_value()) {
+            return;
+        }
+
+        // Written to a temporary file first so concurrent readers never see
+        // a partially written entry.
+        std::error_code error;
+        std::filesystem::create_directories(path->parent_path(), error);
+        if (error) {
+            return;
+        }
+        auto temporaryPath = path.value();
+        temporaryPath += fmt::format(
+            ".{}.tmp",
+            std::chrono::steady_clock::now().time_since_epoch().count()
+        );
+
+        auto bytes = KeymapFile::encode(profile);
+        {
+            std::ofstream file(temporaryPath, std::ios::binary);
+            if (!file) {
+                return;
+            }
+            file.write((const char *)bytes.data(), bytes.size());
+            if (!file) {
+                std::filesystem::remove(temporaryPath, error);
+                return;
+            }
+        }
+        std::filesystem::rename(temporaryPath, path.value(), error);
+        if (error) {
+            std::filesystem::remove(temporaryPath, error);
+        }
+    }
+}
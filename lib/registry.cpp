@@ -0,0 +1,81 @@
+/*
+    Nudelta Console
+    Copyright (C) 2022 Mohamed Gaber
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include "registry.hpp"
+
+#include "hotplug.hpp"
+
+#include <cstdlib>
+#include <mutex>
+
+namespace DeviceRegistry {
+    static std::mutex mutex;
+    static std::optional< std::vector< std::shared_ptr< NuPhy > > > cache;
+    static std::unique_ptr< HotplugMonitor > monitor;
+
+    std::vector< std::shared_ptr< NuPhy > > getAll() {
+        std::lock_guard< std::mutex > lock(mutex);
+        if (cache.has_value()) {
+            return cache.value();
+        }
+
+        auto keyboards = NuPhy::findAll();
+        if (!keyboards.empty() || monitor != nullptr) {
+            cache = keyboards;
+        }
+        return keyboards;
+    }
+
+    std::shared_ptr< NuPhy > get() {
+        auto keyboards = getAll();
+        if (keyboards.empty()) {
+            return nullptr;
+        }
+        return keyboards[0];
+    }
+
+    void invalidate() {
+        std::lock_guard< std::mutex > lock(mutex);
+        cache = std::nullopt;
+    }
+
+    void watchHotplug() {
+        // atexit handlers run in reverse order of registration, so
+        // registering after initHID() has stops the monitor before hid_exit
+        initHID();
+        static std::once_flag registered;
+        std::call_once(registered, []() { atexit(stopHotplug); });
+
+        std::lock_guard< std::mutex > lock(mutex);
+        if (monitor != nullptr) {
+            return;
+        }
+        monitor = std::make_unique< HotplugMonitor >(
+            [](const HotplugEvent &) { invalidate(); }
+        );
+        cache = std::nullopt;
+    }
+
+    void stopHotplug() {
+        std::unique_ptr< HotplugMonitor > stopped;
+        {
+            std::lock_guard< std::mutex > lock(mutex);
+            std::swap(stopped, monitor);
+        }
+        // Joined without the lock, as the monitor's callback takes it
+    }
+}
@@ -0,0 +1,255 @@
+/*
+    Nudelta Console
+    Copyright (C) 2022 Mohamed Gaber
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include "simulator.hpp"
+
+#include "nuphy.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <sstream>
+#include <thread>
+
+static const uint8_t GET_REPORT_ID = 0x05;
+static const uint8_t SET_REPORT_ID = 0x06;
+static const uint8_t KEYMAP_COMMAND = 0x84;
+static const uint8_t SET_KEYMAP_COMMAND = 0x04;
+static const size_t SET_KEYMAP_HEADER_SIZE = 8;
+
+struct SimulatedTransport::Keyboard {
+        std::string productString;
+        std::string serialNumber;
+        std::vector< std::string > paths; // [request, data] on Windows
+
+        std::mutex mutex;
+        // Keyed by the region byte of the report header, i.e. one per mode
+        std::map< uint8_t, std::vector< uint8_t > > keymaps;
+        std::vector< uint8_t > pendingReply;
+        size_t writesToDrop = 0;
+};
+
+class SimulatedDevice : public HIDDevice {
+    public:
+        SimulatedDevice(
+            std::shared_ptr< SimulatedTransport::Keyboard > keyboard,
+            std::chrono::microseconds latency
+        )
+            : keyboard(keyboard), latency(latency) {}
+
+        virtual int sendFeatureReport(const uint8_t *data, size_t size) {
+            simulateLatency();
+            if (size < 3) {
+                error = "Report too short.";
+                return -1;
+            }
+
+            std::lock_guard< std::mutex > lock(keyboard->mutex);
+            auto command = data[1];
+            auto region = data[2];
+            if (data[0] == GET_REPORT_ID) {
+                // Answered by the next Get Report 6
+                std::vector< uint8_t > reply(SET_KEYMAP_HEADER_SIZE, 0x00);
+                reply[0] = SET_REPORT_ID;
+                reply[1] = command;
+                reply[2] = region;
+                auto keymap = keyboard->keymaps.find(region);
+                if (command == KEYMAP_COMMAND
+                    && keymap != keyboard->keymaps.end()) {
+                    reply[4] = 0x40;
+                    reply.insert(
+                        reply.end(),
+                        keymap->second.begin(),
+                        keymap->second.end()
+                    );
+                }
+                keyboard->pendingReply = reply;
+            } else if (data[0] == SET_REPORT_ID
+                       && command == SET_KEYMAP_COMMAND
+                       && size >= SET_KEYMAP_HEADER_SIZE) {
+                if (keyboard->writesToDrop > 0) {
+                    keyboard->writesToDrop -= 1;
+                    return int(size);
+                }
+                keyboard->keymaps[region] = std::vector< uint8_t >(
+                    data + SET_KEYMAP_HEADER_SIZE,
+                    data + size
+                );
+            }
+            return int(size);
+        }
+
+        virtual int getFeatureReport(uint8_t *data, size_t size) {
+            simulateLatency();
+            std::lock_guard< std::mutex > lock(keyboard->mutex);
+            auto &reply = keyboard->pendingReply;
+            if (reply.empty() || data[0] != reply[0]) {
+                error = "No report pending.";
+                return -1;
+            }
+            auto count = std::min(size, reply.size());
+            std::copy(reply.begin(), reply.begin() + count, data);
+            reply.clear();
+            return int(count);
+        }
+
+        virtual std::string getError() { return error; }
+    private:
+        void simulateLatency() {
+            if (latency.count() > 0) {
+                std::this_thread::sleep_for(latency);
+            }
+        }
+
+        std::shared_ptr< SimulatedTransport::Keyboard > keyboard;
+        std::chrono::microseconds latency;
+        std::string error = "Success";
+};
+
+SimulatedTransport::SimulatedTransport(std::chrono::microseconds latency)
+    : latency(latency) {}
+
+std::string SimulatedTransport::addKeyboard(const std::string &model) {
+    auto nuphy = NuPhy::forModel(model);
+
+    auto keyboard = std::make_shared< Keyboard >();
+    keyboard->productString = nuphy->getProductString();
+    for (auto mac : {false, true}) {
+        auto region = nuphy->getKeymapReportHeader(mac)[2];
+        auto &keymap = keyboard->keymaps[region];
+        for (auto word : nuphy->getDefaultKeymap(mac)) {
+            for (auto shift : {0, 8, 16, 24}) {
+                keymap.push_back(uint8_t(word >> shift));
+            }
+        }
+    }
+
+    std::lock_guard< std::mutex > lock(mutex);
+    counter += 1;
+    keyboard->serialNumber = fmt::format("SIM{:04}", counter);
+    auto base = fmt::format("simulated:{}:{}", counter, nuphy->getName());
+#ifdef _WIN32
+    keyboard->paths = {base + "&col05", base + "&col06"};
+#else
+    keyboard->paths = {base};
+#endif
+    for (auto &path : keyboard->paths) {
+        keyboards[path] = keyboard;
+    }
+    return keyboard->paths[0];
+}
+
+void SimulatedTransport::removeKeyboard(const std::string &path) {
+    std::lock_guard< std::mutex > lock(mutex);
+    auto it = keyboards.find(path);
+    if (it == keyboards.end()) {
+        return;
+    }
+    auto keyboard = it->second;
+    for (auto &keyboardPath : keyboard->paths) {
+        keyboards.erase(keyboardPath);
+    }
+}
+
+void SimulatedTransport::dropWrites(const std::string &path, size_t count) {
+    std::lock_guard< std::mutex > lock(mutex);
+    auto it = keyboards.find(path);
+    if (it == keyboards.end()) {
+        return;
+    }
+    std::lock_guard< std::mutex > keyboardLock(it->second->mutex);
+    it->second->writesToDrop = count;
+}
+
+std::vector< HIDDeviceInfo >
+SimulatedTransport::enumerate(uint16_t vendorID, uint16_t productID) {
+    std::vector< HIDDeviceInfo > devices;
+    if (vendorID != 0x05ac || productID != 0x024f) {
+        return devices;
+    }
+
+    std::lock_guard< std::mutex > lock(mutex);
+    for (auto &[path, keyboard] : keyboards) {
+        devices.push_back(
+            {path,
+             vendorID,
+             productID,
+             keyboard->serialNumber,
+             0x0100,
+             "NuPhy",
+             keyboard->productString,
+             0xFF00,
+             1,
+             1}
+        );
+    }
+    return devices;
+}
+
+std::unique_ptr< HIDDevice >
+SimulatedTransport::open(const std::string &path) {
+    std::lock_guard< std::mutex > lock(mutex);
+    auto it = keyboards.find(path);
+    if (it == keyboards.end()) {
+        return nullptr;
+    }
+    return std::make_unique< SimulatedDevice >(it->second, latency);
+}
+
+// The unsigned integer in environment variable `name`, or `fallback` if it is
+// unset. Throws if it is set to anything else.
+static uint64_t getUnsignedEnv(const char *name, uint64_t fallback) {
+    auto value = getenv(name);
+    if (value == nullptr) {
+        return fallback;
+    }
+    char *end = nullptr;
+    errno = 0;
+    auto result = strtoull(value, &end, 10);
+    if (*value < '0' || *value > '9' || *end != '\0' || errno == ERANGE) {
+        throw std::runtime_error(fmt::format(
+            "${} must be an unsigned integer, not '{}'.",
+            name,
+            value
+        ));
+    }
+    return result;
+}
+
+std::shared_ptr< SimulatedTransport > SimulatedTransport::fromEnvironment() {
+    auto models = getenv("NUDELTA_SIMULATE");
+    if (models == nullptr || *models == '\0') {
+        return nullptr;
+    }
+
+    auto latency = std::chrono::microseconds(
+        getUnsignedEnv("NUDELTA_SIMULATE_LATENCY_US", 0)
+    );
+    auto droppedWrites =
+        size_t(getUnsignedEnv("NUDELTA_SIMULATE_DROPPED_WRITES", 0));
+
+    auto transport = std::make_shared< SimulatedTransport >(latency);
+    std::stringstream stream(models);
+    std::string model;
+    while (std::getline(stream, model, ',')) {
+        if (!model.empty()) {
+            auto path = transport->addKeyboard(model);
+            transport->dropWrites(path, droppedWrites);
+        }
+    }
+    return transport;
+}
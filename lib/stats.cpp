@@ -0,0 +1,152 @@
+/*
+    Nudelta Console
+    Copyright (C) 2022 Mohamed Gaber
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include "stats.hpp"
+
+#include "common.hpp"
+
+#include <algorithm>
+
+namespace Stats {
+    static const auto RELAXED = std::memory_order_relaxed;
+
+    void Histogram::record(std::chrono::nanoseconds duration) {
+        uint64_t nanoseconds = std::max< int64_t >(duration.count(), 0);
+
+        size_t bucket = 0;
+        for (auto microseconds = nanoseconds / 1000;
+             microseconds != 0 && bucket < BUCKETS - 1;
+             microseconds >>= 1) {
+            bucket += 1;
+        }
+
+        count.fetch_add(1, RELAXED);
+        totalNanoseconds.fetch_add(nanoseconds, RELAXED);
+        buckets[bucket].fetch_add(1, RELAXED);
+
+        auto max = maxNanoseconds.load(RELAXED);
+        while (nanoseconds > max
+               && !maxNanoseconds.compare_exchange_weak(max, nanoseconds)) {
+        }
+    }
+
+    Histogram::Snapshot Histogram::snapshot() const {
+        Snapshot snapshot;
+        snapshot.count = count.load(RELAXED);
+        snapshot.totalNanoseconds = totalNanoseconds.load(RELAXED);
+        snapshot.maxNanoseconds = maxNanoseconds.load(RELAXED);
+        for (size_t i = 0; i < BUCKETS; i += 1) {
+            snapshot.buckets[i] = buckets[i].load(RELAXED);
+        }
+        return snapshot;
+    }
+
+    double Histogram::Snapshot::meanMicroseconds() const {
+        if (count == 0) {
+            return 0;
+        }
+        return double(totalNanoseconds) / count / 1000;
+    }
+
+    double
+    Histogram::Snapshot::percentileMicroseconds(double percentile) const {
+        // Buckets are read one at a time, so their sum may differ from count
+        uint64_t total = 0;
+        for (auto bucket : buckets) {
+            total += bucket;
+        }
+        if (total == 0) {
+            return 0;
+        }
+
+        auto rank = uint64_t(percentile / 100 * total);
+        uint64_t seen = 0;
+        for (size_t i = 0; i < BUCKETS; i += 1) {
+            seen += buckets[i];
+            if (seen > rank || seen == total) {
+                auto upperBound = double(uint64_t(1) << i);
+                return std::min(upperBound, maxNanoseconds / 1000.0);
+            }
+        }
+        return maxNanoseconds / 1000.0;
+    }
+
+    Metrics &get() {
+        static Metrics metrics;
+        return metrics;
+    }
+
+    Snapshot snapshot() {
+        auto &metrics = get();
+        Snapshot snapshot;
+        snapshot.counters = {
+            {"enumerations", metrics.enumerations.load(RELAXED)},
+            {"opens", metrics.opens.load(RELAXED)},
+            {"openFailures", metrics.openFailures.load(RELAXED)},
+            {"reportsSent", metrics.reportsSent.load(RELAXED)},
+            {"reportsReceived", metrics.reportsReceived.load(RELAXED)},
+            {"bytesWritten", metrics.bytesWritten.load(RELAXED)},
+            {"bytesRead", metrics.bytesRead.load(RELAXED)},
+            {"reportFailures", metrics.reportFailures.load(RELAXED)},
+            {"writeRetries", metrics.writeRetries.load(RELAXED)},
+            {"verificationFailures",
+             metrics.verificationFailures.load(RELAXED)},
+            {"profilesCompiled", metrics.profilesCompiled.load(RELAXED)},
+            {"cacheHits", metrics.cacheHits.load(RELAXED)},
+            {"cacheMisses", metrics.cacheMisses.load(RELAXED)},
+        };
+        snapshot.histograms = {
+            {"enumerateLatency", metrics.enumerateLatency.snapshot()},
+            {"openLatency", metrics.openLatency.snapshot()},
+            {"sendLatency", metrics.sendLatency.snapshot()},
+            {"receiveLatency", metrics.receiveLatency.snapshot()},
+            {"parseLatency", metrics.parseLatency.snapshot()},
+            {"compileLatency", metrics.compileLatency.snapshot()},
+        };
+        return snapshot;
+    }
+
+    std::string format() {
+        auto stats = snapshot();
+
+        std::string formatted;
+        for (auto &[name, value] : stats.counters) {
+            formatted += fmt::format("{:<22}{:>12}\n", name, value);
+        }
+        formatted += fmt::format(
+            "\n{:<22}{:>8}{:>12}{:>12}{:>12}{:>12}\n",
+            "latency (us)",
+            "count",
+            "mean",
+            "p50",
+            "p99",
+            "max"
+        );
+        for (auto &[name, histogram] : stats.histograms) {
+            formatted += fmt::format(
+                "{:<22}{:>8}{:>12.1f}{:>12.1f}{:>12.1f}{:>12.1f}\n",
+                name,
+                histogram.count,
+                histogram.meanMicroseconds(),
+                histogram.percentileMicroseconds(50),
+                histogram.percentileMicroseconds(99),
+                histogram.maxNanoseconds / 1000.0
+            );
+        }
+        return formatted;
+    }
+}
@@ -0,0 +1,154 @@
+/*
+    Nudelta Console
+    Copyright (C) 2022 Mohamed Gaber
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include "trace.hpp"
+
+#include "common.hpp"
+
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <thread>
+
+namespace Trace {
+    std::atomic< bool > enabled = false;
+
+    struct Event {
+            const char *name;
+            const char *category;
+            std::string track;
+            std::string detail;
+            std::chrono::steady_clock::time_point start;
+            std::chrono::steady_clock::duration duration;
+    };
+
+    static std::mutex eventMutex;
+    static std::vector< Event > events;
+    static std::chrono::steady_clock::time_point epoch;
+
+    void enable() {
+        std::lock_guard< std::mutex > lock(eventMutex);
+        if (!enabled) {
+            epoch = std::chrono::steady_clock::now();
+            enabled = true;
+        }
+    }
+
+    static std::string currentThreadTrack() {
+        std::stringstream str;
+        str << "thread " << std::this_thread::get_id();
+        return str.str();
+    }
+
+    Span::Span(
+        const char *name,
+        const char *category,
+        std::string_view track,
+        std::string_view detail
+    )
+        : name(name), category(category), recording(isEnabled()) {
+        if (!recording) {
+            return;
+        }
+        this->track = track.empty() ? currentThreadTrack() : track;
+        this->detail = detail;
+        start = std::chrono::steady_clock::now();
+    }
+
+    Span::~Span() {
+        if (!recording) {
+            return;
+        }
+        auto duration = std::chrono::steady_clock::now() - start;
+        std::lock_guard< std::mutex > lock(eventMutex);
+        events.push_back({name, category, track, detail, start, duration});
+    }
+
+    static std::string escape(std::string_view string) {
+        std::string escaped;
+        for (auto c : string) {
+            if (c == '"' || c == '\\') {
+                escaped += '\\';
+                escaped += c;
+            } else if ((unsigned char)c < 0x20) {
+                escaped += fmt::format("\\u{:04x}", int(c));
+            } else {
+                escaped += c;
+            }
+        }
+        return escaped;
+    }
+
+    static double microseconds(std::chrono::steady_clock::duration duration) {
+        return std::chrono::duration< double, std::micro >(duration).count();
+    }
+
+    void write(const std::string &path) {
+        auto file = fopen(path.c_str(), "w");
+        if (file == nullptr) {
+            throw std::runtime_error(
+                fmt::format("Failed to open '{}' for writing.", path)
+            );
+        }
+
+        std::lock_guard< std::mutex > lock(eventMutex);
+
+        // Chrome traces identify rows by integer thread IDs, named by
+        // metadata events.
+        std::map< std::string, size_t > trackIDs;
+        for (auto &event : events) {
+            trackIDs.emplace(event.track, trackIDs.size() + 1);
+        }
+
+        p(file, "{{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+        p(file,
+          "{{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 1, "
+          "\"args\": {{\"name\": \"nudelta\"}}}}");
+        for (auto &[track, id] : trackIDs) {
+            p(file,
+              ",\n{{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, "
+              "\"tid\": {}, \"args\": {{\"name\": \"{}\"}}}}",
+              id,
+              escape(track));
+        }
+        for (auto &event : events) {
+            p(file,
+              ",\n{{\"name\": \"{}\", \"cat\": \"{}\", \"ph\": \"X\", "
+              "\"pid\": 1, \"tid\": {}, \"ts\": {:.3f}, \"dur\": {:.3f}",
+              escape(event.name),
+              escape(event.category),
+              trackIDs[event.track],
+              microseconds(event.start - epoch),
+              microseconds(event.duration));
+            if (!event.detail.empty()) {
+                p(file,
+                  ", \"args\": {{\"detail\": \"{}\"}}",
+                  escape(event.detail));
+            }
+            p(file, "}}");
+        }
+        p(file, "\n]}}\n");
+
+        auto failed = ferror(file);
+        fclose(file);
+        if (failed) {
+            throw std::runtime_error(
+                fmt::format("Failed to write the trace to '{}'.", path)
+            );
+        }
+    }
+}
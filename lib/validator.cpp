@@ -0,0 +1,300 @@
+/*
+    Nudelta Console
+    Copyright (C) 2022 Mohamed Gaber
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include "validator.hpp"
+
+#include "profile.hpp"
+#include "trace.hpp"
+
+#include <cstring>
+#include <optional>
+#include <string_view>
+#include <yaml-cpp/yaml.h>
+
+// The top-level section an entry belongs to. Entries of sections other than
+// keys and mackeys are parsed, but not checked.
+enum class Section : uint8_t {
+    None,
+    Win,
+    Mac,
+    Other
+};
+
+struct Chunk {
+        Section section;
+        int firstLine; // 0-based
+        std::string_view text;
+};
+
+static bool isBlank(std::string_view line) {
+    auto first = line.find_first_not_of(' ');
+    return first == std::string_view::npos || line[first] == '#';
+}
+
+// Whether a quoted scalar goes on past the end of the line.
+static bool hasOpenQuote(std::string_view line) {
+    char quote = 0;
+    char previous = ' '; // The last character outside of quotes
+    for (size_t i = 0; i < line.size(); i += 1) {
+        auto c = line[i];
+        if (quote != 0) {
+            if (quote == '"' && c == '\\') {
+                i += 1;
+            } else if (c == quote) {
+                quote = 0;
+            }
+            continue;
+        }
+        if (c == '#' && previous == ' ') {
+            break;
+        }
+        // Quotes only start scalars: the one in it's is part of a plain one
+        if ((c == '"' || c == '\'') && strchr(" -:[{,", previous) != nullptr) {
+            quote = c;
+        }
+        previous = c;
+    }
+    return quote != 0;
+}
+
+// A line without its comment and trailing spaces.
+static std::string_view stripComment(std::string_view line) {
+    line = line.substr(0, line.find(" #"));
+    return line.substr(0, line.find_last_not_of(' ') + 1);
+}
+
+// Whether a line is a `key: value` pair or a sequence item, as opposed to
+// e.g. the continuation of a multi-line scalar from the line before.
+static bool isPairOrItem(std::string_view line) {
+    line = stripComment(line);
+    auto first = line.find_first_not_of(' ');
+    if (line[first] == '?' || line[first] == ':') {
+        return false; // Complex keys
+    }
+    if (line.compare(first, 2, "- ") == 0 || line.substr(first) == "-") {
+        return true;
+    }
+    return line.back() == ':' || line.find(": ") != std::string_view::npos;
+}
+
+// Whether a pair or item's value, if any, is on the lines that follow.
+static bool hasValueBelow(std::string_view line) {
+    line = stripComment(line);
+    return line.back() == ':' || line.back() == '-';
+}
+
+// The name of a top-level `name:` line, if that is all there is to it.
+static std::optional< std::string_view > sectionName(std::string_view line) {
+    auto colon = line.find(':');
+    if (colon == std::string_view::npos || colon == 0) {
+        return std::nullopt;
+    }
+    auto name = line.substr(0, colon);
+    if (name.find_first_of("\"'#-?{[") != std::string_view::npos
+        || name.back() == ' ') {
+        return std::nullopt;
+    }
+    auto rest = line.substr(colon + 1);
+    if (!rest.empty() && (rest[0] != ' ' || !isBlank(rest))) {
+        return std::nullopt; // e.g. a flow-style map
+    }
+    return name;
+}
+
+// Splits a block-style profile into its top-level sections' entries, or
+// returns nullopt if that cannot be done without changing how the document
+// would be parsed as a whole.
+static std::optional< std::vector< Chunk > >
+splitEntries(std::string_view document) {
+    // Aliases may refer to anchors in other entries, and tabs would make
+    // telling entries apart by their indentation unreliable.
+    if (document.find_first_of("&*\t") != std::string_view::npos) {
+        return std::nullopt;
+    }
+
+    std::vector< Chunk > chunks;
+    auto open = std::string_view::npos; // Where the open chunk starts
+    auto close = [&](size_t end) {
+        if (open != std::string_view::npos) {
+            chunks.back().text = document.substr(open, end - open);
+            open = std::string_view::npos;
+        }
+    };
+
+    auto section = Section::None;
+    bool seenWin = false, seenMac = false;
+    size_t entryIndentation = 0;
+    // The indentation of the last pair or item whose value is yet to come
+    auto valueBelow = std::string_view::npos;
+    size_t start = 0;
+    int lineNumber = 0;
+    while (start < document.size()) {
+        auto end = document.find('\n', start);
+        if (end == std::string_view::npos) {
+            end = document.size();
+        }
+        auto line = document.substr(start, end - start);
+        if (!line.empty() && line.back() == '\r') {
+            line.remove_suffix(1);
+        }
+
+        if (isBlank(line)) {
+            // Belongs to whichever chunk is open
+            start = end + 1;
+            lineNumber += 1;
+            continue;
+        }
+        if (hasOpenQuote(line)) {
+            return std::nullopt;
+        }
+
+        // Where an empty value is said to be depends on what comes next,
+        // which might be in another entry.
+        auto indentation = line.find_first_not_of(' ');
+        if (valueBelow != std::string_view::npos && indentation <= valueBelow) {
+            return std::nullopt;
+        }
+        valueBelow = std::string_view::npos;
+
+        if (indentation == 0) {
+            close(start);
+            auto name = sectionName(line);
+            if (!name.has_value()) {
+                return std::nullopt;
+            }
+            if (*name == "keys" || *name == "mackeys") {
+                auto mac = *name == "mackeys";
+                auto &seen = mac ? seenMac : seenWin;
+                if (seen) {
+                    return std::nullopt;
+                }
+                seen = true;
+                section = mac ? Section::Mac : Section::Win;
+            } else {
+                section = Section::Other;
+                chunks.push_back({section, lineNumber, {}});
+                open = start;
+            }
+            entryIndentation = 0;
+        } else if (section == Section::None || !isPairOrItem(line)) {
+            return std::nullopt;
+        } else {
+            if (hasValueBelow(line)) {
+                valueBelow = indentation;
+            }
+            if (section != Section::Other) {
+                if (entryIndentation == 0) {
+                    entryIndentation = indentation;
+                }
+                if (indentation < entryIndentation) {
+                    return std::nullopt;
+                }
+                if (indentation == entryIndentation) {
+                    if (line[indentation] == '-') {
+                        return std::nullopt; // Not a map
+                    }
+                    close(start);
+                    chunks.push_back({section, lineNumber, {}});
+                    open = start;
+                }
+            }
+        }
+
+        start = end + 1;
+        lineNumber += 1;
+    }
+    if (valueBelow != std::string_view::npos) {
+        return std::nullopt;
+    }
+    close(document.size());
+
+    return chunks;
+}
+
+IncrementalValidator::IncrementalValidator(
+    std::shared_ptr< NuPhy > keyboard,
+    bool rawOk
+)
+    : keyboard(keyboard), rawOk(rawOk) {}
+
+std::vector< NuPhy::Diagnostic >
+IncrementalValidator::update(const std::string &yamlString) {
+    auto validateAll = [&] {
+        entriesChecked = -1;
+        return keyboard->diagnoseYAMLKeymap(yamlString, rawOk);
+    };
+
+    auto chunks = splitEntries(yamlString);
+    if (!chunks.has_value()) {
+        return validateAll();
+    }
+
+    Trace::Span span("validate incrementally", "profile");
+    std::unordered_map< uint64_t, std::vector< NuPhy::Diagnostic > > current;
+    std::vector< NuPhy::Diagnostic > diagnostics[2];
+    entriesChecked = 0;
+    for (auto &chunk : *chunks) {
+        auto hash = fnv1a64(&chunk.section, sizeof chunk.section);
+        hash = fnv1a64(chunk.text.data(), chunk.text.size(), hash);
+
+        auto it = checked.find(hash);
+        if (it == checked.end()) {
+            // Syntax errors are reported where the whole document's parser
+            // finds them, which may well be in another entry.
+            YAML::Node node;
+            try {
+                node = YAML::Load(std::string(chunk.text));
+            } catch (YAML::ParserException &) {
+                return validateAll();
+            }
+            if (!node.IsMap() || node.size() != 1) {
+                return validateAll();
+            }
+
+            std::vector< NuPhy::Diagnostic > found;
+            if (chunk.section != Section::Other) {
+                auto entry = *node.begin();
+                keyboard->validateYAMLEntry(
+                    entry.first,
+                    entry.second,
+                    rawOk,
+                    chunk.section == Section::Mac,
+                    found
+                );
+            }
+            it = checked.emplace(hash, std::move(found)).first;
+            entriesChecked += 1;
+        }
+        current.insert(*it);
+
+        // Windows diagnostics come before Mac ones, as in a full validation
+        auto &into = diagnostics[chunk.section == Section::Mac];
+        for (const auto &diagnostic : it->second) {
+            into.push_back(diagnostic);
+            if (diagnostic.line != 0) {
+                into.back().line += chunk.firstLine;
+            }
+        }
+    }
+
+    // Only what the latest version could still reuse is kept
+    checked = std::move(current);
+
+    auto &result = diagnostics[0];
+    result.insert(result.end(), diagnostics[1].begin(), diagnostics[1].end());
+    return result;
+}
@@ -0,0 +1,488 @@
+/*
+    Nudelta Console
+    Copyright (C) 2022 Mohamed Gaber
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+// nd_bench: microbenchmarks for each stage of the keymap pipeline, run
+// against a simulated keyboard so no hardware is needed.
+//
+// Every result is printed to stdout as one JSON object per line, so runs of
+// different releases can be diffed or collected by a script.
+#include "bank.hpp"
+#include "nuphy.hpp"
+#include "simulator.hpp"
+#include "validator.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <fmt/format.h>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <optional>
+#include <scope_guard.hpp>
+#include <yaml-cpp/yaml.h>
+
+#ifndef NUDELTA_VERSION
+    #define NUDELTA_VERSION "UNKNOWN"
+#endif
+#ifndef NUDELTA_SOURCE_DIR
+    #define NUDELTA_SOURCE_DIR "."
+#endif
+
+struct Profile {
+        std::string name;
+        std::string yaml;
+};
+
+struct Options {
+        std::chrono::nanoseconds minimumTime = std::chrono::milliseconds(200);
+        size_t samples = 9;
+        std::string filter = "";
+        std::vector< std::string > profilePaths;
+};
+
+// Written to so the benchmarked work cannot be optimized away
+static volatile uint64_t sink = 0;
+
+// Runs `job` in batches large enough to take `minimumTime / samples` each,
+// then reports the per-operation time of every batch.
+static void measure(
+    const Options &options,
+    const std::string &benchmark,
+    const std::string &model,
+    const std::string &profile,
+    const std::function< void() > &job
+) {
+    auto id = fmt::format("{}/{}/{}", benchmark, model, profile);
+    if (id.find(options.filter) == std::string::npos) {
+        return;
+    }
+
+    using clock = std::chrono::steady_clock;
+    auto run = [&](size_t iterations) {
+        auto start = clock::now();
+        for (size_t i = 0; i < iterations; i += 1) {
+            job();
+        }
+        return std::chrono::duration_cast< std::chrono::nanoseconds >(
+            clock::now() - start
+        );
+    };
+
+    // Calibrate (which doubles as warm-up)
+    auto batchTime = options.minimumTime / options.samples;
+    size_t iterations = 1;
+    while (true) {
+        auto elapsed = run(iterations);
+        if (elapsed >= batchTime || iterations >= (size_t(1) << 30)) {
+            break;
+        }
+        iterations *= 2;
+    }
+
+    std::vector< double > nsPerOp;
+    for (size_t i = 0; i < options.samples; i += 1) {
+        nsPerOp.push_back(double(run(iterations).count()) / iterations);
+    }
+    std::sort(nsPerOp.begin(), nsPerOp.end());
+    double mean = 0;
+    for (auto sample : nsPerOp) {
+        mean += sample / nsPerOp.size();
+    }
+
+    p("{{\"version\": \"{}\", \"benchmark\": \"{}\", \"model\": \"{}\", "
+      "\"profile\": \"{}\", \"iterations\": {}, \"samples\": {}, "
+      "\"ns_per_op_min\": {:.1f}, \"ns_per_op_median\": {:.1f}, "
+      "\"ns_per_op_mean\": {:.1f}, \"ns_per_op_max\": {:.1f}}}\n",
+      NUDELTA_VERSION,
+      benchmark,
+      model,
+      profile,
+      iterations,
+      nsPerOp.size(),
+      nsPerOp.front(),
+      nsPerOp[nsPerOp.size() / 2],
+      mean,
+      nsPerOp.back());
+    fflush(stdout);
+}
+
+static std::string readFile(const std::filesystem::path &path) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        throw std::runtime_error(
+            fmt::format("Failed to open '{}'.", path.string())
+        );
+    }
+    return std::string(
+        (std::istreambuf_iterator< char >(file)),
+        std::istreambuf_iterator< char >()
+    );
+}
+
+static std::vector< Profile > loadProfiles(const Options &options) {
+    std::vector< std::string > paths = options.profilePaths;
+    if (paths.empty()) {
+        auto sourceDirectory = std::filesystem::path(NUDELTA_SOURCE_DIR);
+        paths.push_back((sourceDirectory / "example.yml").string());
+    }
+
+    std::vector< Profile > profiles;
+    for (auto &path : paths) {
+        if (std::filesystem::is_directory(path)) {
+            for (auto &entry :
+                 std::filesystem::recursive_directory_iterator(path)) {
+                auto extension = entry.path().extension();
+                if (entry.is_regular_file()
+                    && (extension == ".yml" || extension == ".yaml")) {
+                    profiles.push_back(
+                        {entry.path().filename().string(),
+                         readFile(entry.path())}
+                    );
+                }
+            }
+        } else {
+            profiles.push_back(
+                {std::filesystem::path(path).filename().string(),
+                 readFile(path)}
+            );
+        }
+    }
+    return profiles;
+}
+
+// Remaps every key of both modes, cycling through every keycode and
+// modifier, so compilation touches every table.
+static Profile synthesizeFullProfile(NuPhy &keyboard) {
+    auto &keycodes = keyboard.getKeycodesByKeyName();
+    auto &modifiers = keyboard.getModifiersByModifierName();
+
+    YAML::Node config;
+    size_t i = 0;
+    for (auto mac : {false, true}) {
+        auto topLevelKey = mac ? "mackeys" : "keys";
+        for (auto &entry : keyboard.getIndicesByKeyName(mac)) {
+            auto key = std::string(entry.first);
+            auto &codeEntry = keycodes.begin()[i % keycodes.size()];
+            auto code = std::string(codeEntry.first);
+            if (i % 3 == 0) {
+                YAML::Node codeObject;
+                codeObject["key"] = code;
+                for (size_t j = 0; j <= i % modifiers.size(); j += 1) {
+                    codeObject["modifiers"].push_back(
+                        std::string(modifiers.begin()[j].first)
+                    );
+                }
+                config[topLevelKey][key] = codeObject;
+            } else {
+                config[topLevelKey][key] = code;
+            }
+            i += 1;
+        }
+    }
+
+    YAML::Emitter emitter;
+    emitter << config;
+    return {"synthetic-full", emitter.c_str()};
+}
+
+// Sets every key of both modes to a raw keycode, which skips the keycode
+// lookups entirely.
+static Profile synthesizeRawProfile(NuPhy &keyboard) {
+    YAML::Node config;
+    uint32_t raw = 0x00040000;
+    for (auto mac : {false, true}) {
+        auto topLevelKey = mac ? "mackeys" : "keys";
+        for (auto &entry : keyboard.getIndicesByKeyName(mac)) {
+            config[topLevelKey][std::string(entry.first)]["raw"] = raw;
+            raw += 1;
+        }
+    }
+
+    YAML::Emitter emitter;
+    emitter << config;
+    return {"synthetic-raw", emitter.c_str()};
+}
+
+static bool isValidFor(NuPhy &keyboard, const std::string &yaml) {
+    try {
+        keyboard.validateYAMLKeymap(yaml, true, false);
+        keyboard.validateYAMLKeymap(yaml, true, true);
+        return true;
+    } catch (std::runtime_error &) {
+        return false;
+    }
+}
+
+static void benchmarkProfiles(
+    const Options &options,
+    NuPhy &keyboard,
+    const std::vector< Profile > &profiles
+) {
+    auto model = keyboard.getName();
+    for (auto &profile : profiles) {
+        if (!isValidFor(keyboard, profile.yaml)) {
+            p(stderr,
+              "Skipping profile '{}' for {}: not valid for this model.\n",
+              profile.name,
+              model);
+            continue;
+        }
+
+        measure(options, "validate", model, profile.name, [&]() {
+            keyboard.validateYAMLKeymap(profile.yaml, true, false);
+            keyboard.validateYAMLKeymap(profile.yaml, true, true);
+        });
+        // What an editor validating as the user types pays per keystroke
+        IncrementalValidator validator(NuPhy::forModel(model), true);
+        std::string versions[] = {profile.yaml, profile.yaml + "\n# edited\n"};
+        size_t edits = 0;
+        measure(options, "validate-edit", model, profile.name, [&]() {
+            auto diagnostics = validator.update(versions[edits++ % 2]);
+            sink = sink + diagnostics.size();
+        });
+        measure(options, "compile", model, profile.name, [&]() {
+            auto compiled = keyboard.compileYAMLKeymap(profile.yaml, false);
+            sink = sink + compiled.keymapWin[0];
+        });
+    }
+}
+
+// Looks every valid profile up in a bank holding all of them, i.e. what
+// switching profiles costs besides the writes.
+static void benchmarkBank(
+    const Options &options,
+    NuPhy &keyboard,
+    const std::vector< Profile > &profiles
+) {
+    std::vector< ProfileBank::Entry > entries;
+    for (auto &profile : profiles) {
+        if (isValidFor(keyboard, profile.yaml)) {
+            entries.push_back(
+                {profile.name, keyboard.compileYAMLKeymap(profile.yaml, false)}
+            );
+        }
+    }
+
+    auto path = std::filesystem::temp_directory_path()
+        / fmt::format("nd_bench_{}.ndb", keyboard.getName());
+    auto bytes = ProfileBank::build(entries);
+    std::ofstream(path, std::ios::binary)
+        .write((const char *)bytes.data(), bytes.size());
+    SCOPE_EXIT {
+        std::error_code error;
+        std::filesystem::remove(path, error);
+    };
+
+    auto bank = ProfileBank::open(path.string());
+    auto model = keyboard.getName();
+    for (auto &entry : entries) {
+        measure(options, "bank-find", model, entry.name, [&]() {
+            auto file = bank->find(entry.name, model);
+            sink = sink + file->getKeymap(false)[0];
+        });
+    }
+}
+
+static void benchmarkLookups(const Options &options, NuPhy &keyboard) {
+    auto model = keyboard.getName();
+    std::vector< std::pair< std::string, const NameTable * > > tables = {
+        {"indices-win", &keyboard.getIndicesByKeyName(false)},
+        {"indices-mac", &keyboard.getIndicesByKeyName(true)},
+        {"keycodes", &keyboard.getKeycodesByKeyName()},
+        {"modifiers", &keyboard.getModifiersByModifierName()},
+    };
+    for (auto &[tableName, table] : tables) {
+        // One operation is one lookup, hit or miss
+        std::vector< std::string > names;
+        for (auto &entry : *table) {
+            names.push_back(std::string(entry.first));
+            names.push_back(std::string(entry.first) + "_");
+        }
+        size_t i = 0;
+        measure(options, "lookup", model, tableName, [&]() {
+            auto it = table->find(names[i]);
+            sink = sink + (it == table->end() ? 0 : it->second);
+            i = (i + 1) % names.size();
+        });
+    }
+}
+
+static void benchmarkReports(const Options &options, NuPhy &keyboard) {
+    auto model = keyboard.getName();
+    auto session = keyboard.openSession();
+    for (auto mac : {false, true}) {
+        auto mode = mac ? "mac" : "win";
+        auto defaultKeymap = keyboard.getDefaultKeymap(mac);
+        auto keymap = std::vector< uint32_t >(
+            defaultKeymap.begin(),
+            defaultKeymap.end()
+        );
+
+        measure(options, "set-keymap", model, mode, [&]() {
+            keyboard.setKeymap(keymap, mac, session);
+        });
+        measure(options, "read-keymap", model, mode, [&]() {
+            auto read = keyboard.readKeymap(mac, *session);
+            sink = sink + read[0];
+        });
+    }
+}
+
+static void benchmarkPrettyPrint(const Options &options, NuPhy &keyboard) {
+#ifdef _WIN32
+    auto devNull = fopen("NUL", "w");
+#else
+    auto devNull = fopen("/dev/null", "w");
+#endif
+    if (devNull == nullptr) {
+        throw std::runtime_error("Failed to open the null device.");
+    }
+
+    auto keymap = keyboard.getDefaultKeymap(false);
+    std::vector< uint8_t > bytes;
+    for (auto word : keymap) {
+        for (auto shift : {0, 8, 16, 24}) {
+            bytes.push_back(uint8_t(word >> shift));
+        }
+    }
+    measure(options, "pretty-print", keyboard.getName(), "default-win", [&]() {
+        prettyPrintBinary(bytes, devNull);
+    });
+    measure(options, "annotate", keyboard.getName(), "default-win", [&]() {
+        auto annotations = keyboard.annotateKeymap(keymap);
+        auto out = formatBinary(bytes.data(), bytes.size(), annotations);
+        fwrite(out.data(), 1, out.size(), devNull);
+    });
+
+    fclose(devNull);
+}
+
+static void benchmarkEnumeration(
+    const Options &options,
+    const std::vector< std::string > &models
+) {
+    for (size_t count : {1, 4, 16}) {
+        auto transport = std::make_shared< SimulatedTransport >();
+        for (size_t i = 0; i < count; i += 1) {
+            transport->addKeyboard(models[i % models.size()]);
+        }
+        HIDTransport::set(transport);
+        measure(
+            options,
+            "find-all",
+            "mixed",
+            fmt::format("{}-keyboards", count),
+            [&]() {
+                auto keyboards = NuPhy::findAll();
+                sink = sink + keyboards.size();
+            }
+        );
+    }
+}
+
+static void printUsage(const char *argv0) {
+    p(stderr,
+      "Usage: {} [--min-time-ms <ms>] [--samples <n>] [--filter <substring>] "
+      "[profile.yml | directory]...\n"
+      "\n"
+      "Profiles default to example.yml from the source tree. Synthetic "
+      "profiles covering every key of each model are always included.\n",
+      argv0);
+}
+
+// The unsigned integer `value`, or std::nullopt if it is anything else.
+static std::optional< uint64_t > parseUnsigned(const char *value) {
+    char *end = nullptr;
+    errno = 0;
+    auto result = strtoull(value, &end, 10);
+    if (*value < '0' || *value > '9' || *end != '\0' || errno == ERANGE) {
+        return std::nullopt;
+    }
+    return result;
+}
+
+int main(int argc, char *argv[]) {
+    Options options;
+    for (int i = 1; i < argc; i += 1) {
+        auto argument = std::string(argv[i]);
+        auto hasValue = i + 1 < argc;
+        if ((argument == "--min-time-ms" || argument == "--samples")
+            && hasValue) {
+            auto value = parseUnsigned(argv[++i]);
+            if (!value.has_value()) {
+                p(stderr,
+                  "[ERROR] {} takes an unsigned integer, not '{}'.\n",
+                  argument,
+                  argv[i]);
+                return 64;
+            }
+            if (argument == "--samples") {
+                options.samples = std::max(size_t(value.value()), size_t(1));
+            } else {
+                options.minimumTime =
+                    std::chrono::milliseconds(int64_t(value.value()));
+            }
+        } else if (argument == "--filter" && hasValue) {
+            options.filter = argv[++i];
+        } else if (argument == "--help" || argument == "-h") {
+            printUsage(argv[0]);
+            return 0;
+        } else if (argument.rfind("--", 0) == 0) {
+            printUsage(argv[0]);
+            return 64;
+        } else {
+            options.profilePaths.push_back(argument);
+        }
+    }
+
+    try {
+        auto profiles = loadProfiles(options);
+
+        // Including any model packs found
+        auto models = ModelRegistry::getNames();
+        if (models.empty()) {
+            throw std::runtime_error("No keyboard models are available.");
+        }
+        auto transport = std::make_shared< SimulatedTransport >();
+        for (auto &model : models) {
+            transport->addKeyboard(model);
+        }
+        HIDTransport::set(transport);
+
+        for (auto &keyboard : NuPhy::findAll()) {
+            auto modelProfiles = profiles;
+            modelProfiles.push_back(synthesizeFullProfile(*keyboard));
+            modelProfiles.push_back(synthesizeRawProfile(*keyboard));
+
+            benchmarkProfiles(options, *keyboard, modelProfiles);
+            benchmarkBank(options, *keyboard, modelProfiles);
+            benchmarkLookups(options, *keyboard);
+            benchmarkReports(options, *keyboard);
+            benchmarkPrettyPrint(options, *keyboard);
+        }
+
+        benchmarkEnumeration(options, models);
+    } catch (std::runtime_error &e) {
+        p(stderr, "[ERROR] {}\n", e.what());
+        return -1;
+    }
+
+    return 0;
+}
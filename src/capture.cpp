@@ -0,0 +1,561 @@
+/*
+    Nudelta Console
+    Copyright (C) 2022 Mohamed Gaber
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+// nd_capture: extracts the keymaps exchanged with a keyboard from a USB
+// capture, e.g. one of the NuPhy Console taken with Wireshark on usbmon, as
+// the default keymap and index tables under res/ that util/res_to_cpp.js
+// turns into code.
+//
+// Captures are pcap or pcapng files of Linux usbmon traffic. They are mapped
+// into memory and read once, front to back, without copying packets, so
+// multi-gigabyte captures take about as long as reading them off the disk.
+#include "mapping.hpp"
+#include "nuphy.hpp"
+
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <fmt/format.h>
+#include <fstream>
+#include <map>
+#include <set>
+#include <unordered_map>
+
+// pcap(ng) link types, see https://www.tcpdump.org/linktypes.html
+static const uint32_t LINKTYPE_USB_LINUX = 189;
+static const uint32_t LINKTYPE_USB_LINUX_MMAPPED = 220;
+
+// Feature reports, see util/usb/docs.md
+static const uint8_t REQUEST_REPORT_ID = 0x05;
+static const uint8_t DATA_REPORT_ID = 0x06;
+static const uint8_t KEYMAP_COMMAND = 0x84;
+static const uint8_t SET_KEYMAP_COMMAND = 0x04;
+static const size_t KEYMAP_HEADER_SIZE = 8;
+
+// HID class requests, see the USB HID specification, section 7.2
+static const uint8_t SET_REPORT_REQUEST_TYPE = 0x21;
+static const uint8_t GET_REPORT_REQUEST_TYPE = 0xa1;
+static const uint8_t SET_REPORT = 0x09;
+static const uint8_t GET_REPORT = 0x01;
+static const uint8_t FEATURE_REPORT_TYPE = 0x03;
+
+static const uint8_t URB_SUBMIT = 'S';
+static const uint8_t URB_COMPLETE = 'C';
+static const uint8_t URB_CONTROL = 2;
+
+struct Options {
+        std::string capturePath;
+        std::filesystem::path outputPath;
+        // bus << 8 | device, if only one keyboard's traffic is wanted
+        std::optional< uint32_t > address;
+        std::optional< uint8_t > winRegion;
+        std::optional< uint8_t > macRegion;
+};
+
+// Reads integers in the byte order of the capture, which is that of the
+// machine that took it, as is the usbmon header of each packet.
+struct ByteOrder {
+        bool swapped = false;
+
+        uint16_t u16(const uint8_t *at) const {
+            uint16_t value;
+            memcpy(&value, at, sizeof value);
+            return swapped ? uint16_t((value >> 8) | (value << 8)) : value;
+        }
+        uint32_t u32(const uint8_t *at) const {
+            uint32_t value;
+            memcpy(&value, at, sizeof value);
+            if (swapped) {
+                value = ((value >> 24) & 0xff) | ((value >> 8) & 0xff00)
+                    | ((value << 8) & 0xff0000) | (value << 24);
+            }
+            return value;
+        }
+        uint64_t u64(const uint8_t *at) const {
+            uint64_t low = u32(at), high = u32(at + 4);
+            return swapped ? (low << 32) | high : (high << 32) | low;
+        }
+};
+
+struct Packet {
+        uint32_t linkType;
+        ByteOrder order;
+        const uint8_t *data;
+        size_t size;
+};
+
+struct Counters {
+        size_t packets = 0;
+        size_t urbs = 0;
+        size_t featureReports = 0;
+        size_t keymapReads = 0;
+        size_t keymapWrites = 0;
+};
+
+class capture_error : public std::runtime_error {
+    public:
+        capture_error(size_t offset, const std::string &what)
+            : std::runtime_error(fmt::format("At byte {}: {}", offset, what)
+            ) {}
+};
+
+// Captures that were still being written, or whose capture was killed, end
+// in the middle of a packet: what comes before it is still worth reading.
+static void warnTruncated(size_t offset) {
+    p(stderr, "[WARN] The capture is cut off at byte {}.\n", offset);
+}
+
+// Calls `onPacket` for every packet of a classic pcap file.
+template < typename Fn >
+static void readPcap(Span< uint8_t > file, Fn onPacket) {
+    static const size_t HEADER_SIZE = 24, RECORD_HEADER_SIZE = 16;
+    if (file.size() < HEADER_SIZE) {
+        throw capture_error(0, "Truncated pcap header.");
+    }
+
+    ByteOrder order;
+    auto magic = order.u32(file.data());
+    order.swapped = magic == 0xd4c3b2a1 || magic == 0x4d3cb2a1;
+    auto linkType = order.u32(file.data() + 20) & 0xffff;
+
+    size_t offset = HEADER_SIZE;
+    while (offset + RECORD_HEADER_SIZE <= file.size()) {
+        auto record = file.data() + offset;
+        auto capturedSize = order.u32(record + 8);
+        offset += RECORD_HEADER_SIZE;
+        if (capturedSize > file.size() - offset) {
+            warnTruncated(offset);
+            return;
+        }
+        onPacket(Packet{linkType, order, file.data() + offset, capturedSize});
+        offset += capturedSize;
+    }
+}
+
+// Calls `onPacket` for every packet of a pcapng file, which may hold several
+// sections, each with its own byte order and interfaces.
+template < typename Fn >
+static void readPcapng(Span< uint8_t > file, Fn onPacket) {
+    static const uint32_t SECTION_HEADER = 0x0a0d0d0a;
+    static const uint32_t INTERFACE_DESCRIPTION = 1;
+    static const uint32_t OBSOLETE_PACKET = 2;
+    static const uint32_t SIMPLE_PACKET = 3;
+    static const uint32_t ENHANCED_PACKET = 6;
+    static const uint32_t BYTE_ORDER_MAGIC = 0x1a2b3c4d;
+
+    ByteOrder order;
+    std::vector< uint32_t > linkTypes; // By interface
+    std::vector< uint32_t > snapLengths;
+
+    size_t offset = 0;
+    while (offset + 12 <= file.size()) {
+        auto block = file.data() + offset;
+        auto type = order.u32(block);
+        if (type == SECTION_HEADER) {
+            order.swapped = false;
+            auto magic = order.u32(block + 8);
+            if (magic != BYTE_ORDER_MAGIC) {
+                order.swapped = true;
+                if (order.u32(block + 8) != BYTE_ORDER_MAGIC) {
+                    throw capture_error(offset, "Invalid section header.");
+                }
+            }
+            linkTypes.clear();
+            snapLengths.clear();
+        }
+
+        auto length = order.u32(block + 4);
+        if (length < 12 || length % 4 != 0) {
+            throw capture_error(offset, "Invalid block.");
+        }
+        if (length > file.size() - offset) {
+            warnTruncated(offset);
+            return;
+        }
+        auto body = block + 8;
+        auto bodySize = size_t(length) - 12;
+
+        auto emit = [&](uint32_t interface, size_t at, size_t size) {
+            if (interface >= linkTypes.size()) {
+                throw capture_error(offset, "Packet of an unknown interface.");
+            }
+            if (at + size > bodySize) {
+                throw capture_error(offset, "Truncated packet.");
+            }
+            onPacket(Packet{linkTypes[interface], order, body + at, size});
+        };
+
+        if (type == INTERFACE_DESCRIPTION && bodySize >= 8) {
+            linkTypes.push_back(order.u16(body));
+            snapLengths.push_back(order.u32(body + 4));
+        } else if (type == ENHANCED_PACKET && bodySize >= 20) {
+            emit(order.u32(body), 20, order.u32(body + 12));
+        } else if (type == OBSOLETE_PACKET && bodySize >= 20) {
+            emit(order.u16(body), 20, order.u32(body + 12));
+        } else if (type == SIMPLE_PACKET && bodySize >= 4) {
+            // Only as long as the snapshot length allows
+            size_t size = order.u32(body);
+            if (!snapLengths.empty() && snapLengths[0] != 0) {
+                size = std::min< size_t >(size, snapLengths[0]);
+            }
+            emit(0, 4, std::min(size, bodySize - 4));
+        }
+
+        offset += length;
+    }
+}
+
+class Extractor {
+    public:
+        Extractor(const Options &options) : options(options) {}
+
+        void onPacket(const Packet &packet) {
+            counters.packets += 1;
+
+            size_t headerSize;
+            if (packet.linkType == LINKTYPE_USB_LINUX_MMAPPED) {
+                headerSize = 64;
+            } else if (packet.linkType == LINKTYPE_USB_LINUX) {
+                headerSize = 48;
+            } else {
+                return;
+            }
+            if (packet.size < headerSize) {
+                return;
+            }
+            counters.urbs += 1;
+
+            // struct usbmon_packet, see Documentation/usb/usbmon.rst
+            auto urb = packet.data;
+            auto &order = packet.order;
+            auto type = urb[8];
+            auto address = uint32_t(order.u16(urb + 12)) << 8 | urb[11];
+            if (urb[9] != URB_CONTROL
+                || (options.address.has_value() && address != *options.address
+                )) {
+                return;
+            }
+
+            auto id = order.u64(urb);
+            auto setup = urb + 40;
+            auto hasSetup = urb[14] == 0;
+            auto dataSize = std::min< size_t >(
+                order.u32(urb + 36),
+                packet.size - headerSize
+            );
+            auto data = Span< uint8_t >(urb + headerSize, dataSize);
+
+            auto isFeatureReport = hasSetup && setup[3] == FEATURE_REPORT_TYPE;
+            if (type == URB_SUBMIT && isFeatureReport) {
+                if (setup[0] == SET_REPORT_REQUEST_TYPE
+                    && setup[1] == SET_REPORT) {
+                    counters.featureReports += 1;
+                    onSetReport(address, data);
+                } else if (setup[0] == GET_REPORT_REQUEST_TYPE
+                           && setup[1] == GET_REPORT) {
+                    counters.featureReports += 1;
+                    pendingGets[id] = address;
+                }
+            } else if (type == URB_COMPLETE) {
+                auto pending = pendingGets.find(id);
+                if (pending != pendingGets.end()
+                    && pending->second == address) {
+                    pendingGets.erase(pending);
+                    onGetReport(address, data);
+                }
+            }
+        }
+
+        // Writes the tables of every keymap found, returning the paths
+        // written.
+        std::vector< std::filesystem::path > write() const;
+
+        const Counters &getCounters() const { return counters; }
+    private:
+        // The first keymap the keyboard sent back, i.e. what it held when
+        // the capture began, or failing that, the first one it was sent
+        struct Keymap {
+                std::vector< uint32_t > words;
+                bool read;
+        };
+
+        void onKeymap(
+            uint32_t address,
+            uint8_t region,
+            Span< uint8_t > data,
+            bool read
+        ) {
+            addresses.insert(address);
+
+            auto &keymap = keymaps[region];
+            if (!keymap.words.empty() && (keymap.read || !read)) {
+                return;
+            }
+            keymap.words.clear();
+            for (size_t i = KEYMAP_HEADER_SIZE; i + 4 <= data.size(); i += 4) {
+                keymap.words.push_back(readLE32(data.data() + i));
+            }
+            keymap.read = read;
+        }
+
+        void onSetReport(uint32_t address, Span< uint8_t > data) {
+            if (data.size() < 3) {
+                return;
+            }
+            if (data[0] == REQUEST_REPORT_ID) {
+                lastRequests[address] = {data[1], data[2]};
+            } else if (data[0] == DATA_REPORT_ID
+                       && data[1] == SET_KEYMAP_COMMAND
+                       && data.size() > KEYMAP_HEADER_SIZE) {
+                counters.keymapWrites += 1;
+                onKeymap(address, data[2], data, false);
+            }
+        }
+
+        void onGetReport(uint32_t address, Span< uint8_t > data) {
+            if (data.size() <= KEYMAP_HEADER_SIZE
+                || data[0] != DATA_REPORT_ID) {
+                return;
+            }
+            // Replies echo the request, which is checked too in case they
+            // do not on every firmware
+            auto request = lastRequests.find(address);
+            if (data[1] == KEYMAP_COMMAND) {
+                counters.keymapReads += 1;
+                onKeymap(address, data[2], data, true);
+            } else if (request != lastRequests.end()
+                       && request->second.first == KEYMAP_COMMAND) {
+                counters.keymapReads += 1;
+                onKeymap(address, request->second.second, data, true);
+            }
+        }
+
+        const Options &options;
+        Counters counters;
+        // Get Report submissions awaiting completion, by URB ID
+        std::unordered_map< uint64_t, uint32_t > pendingGets;
+        // The last command and region requested, by address
+        std::map< uint32_t, std::pair< uint8_t, uint8_t > > lastRequests;
+        std::map< uint8_t, Keymap > keymaps; // By region
+        std::set< uint32_t > addresses;
+};
+
+static std::string describeAddress(uint32_t address) {
+    return fmt::format("{}.{}", address >> 8, address & 0xff);
+}
+
+static void
+writeText(const std::filesystem::path &path, const std::string &text) {
+    std::ofstream file(path, std::ios::binary);
+    file.write(text.data(), text.size());
+    if (!file.good()) {
+        throw std::runtime_error(
+            fmt::format("Failed to write '{}'.", path.string())
+        );
+    }
+}
+
+std::vector< std::filesystem::path > Extractor::write() const {
+    if (addresses.size() > 1) {
+        std::vector< std::string > list;
+        for (auto address : addresses) {
+            list.push_back(describeAddress(address));
+        }
+        throw std::runtime_error(fmt::format(
+            "Keymaps were exchanged with several devices ({}): pick one with --device.",
+            fmt::join(list, ", ")
+        ));
+    }
+
+    std::unordered_map< uint32_t, std::string_view > keyNamesByKeycode;
+    for (auto &[name, keycode] : NuPhy::keycodesByKeyName) {
+        keyNamesByKeycode.emplace(keycode, name);
+    }
+
+    std::filesystem::create_directories(options.outputPath);
+    std::vector< std::filesystem::path > written;
+    for (auto &[region, keymap] : keymaps) {
+        // Named as util/res_to_cpp.js expects for either mode, and after
+        // the region otherwise
+        std::string suffix, mode;
+        if (region == options.winRegion) {
+            suffix = "win", mode = "Win";
+        } else if (region == options.macRegion) {
+            suffix = "mac", mode = "Mac";
+        } else {
+            suffix = fmt::format("{:02x}", region);
+            mode = "_" + suffix;
+        }
+
+        std::string list = fmt::format("# list defaultKeymap{}\n", mode);
+        for (auto word : keymap.words) {
+            list += fmt::format("- 0x{:08x}\n", word);
+        }
+
+        // A key's default keycode is usually that of the key itself. Those
+        // that are not, or not uniquely so, are left for a human.
+        std::string dict = fmt::format("# dict indicesByKeyName{}\n", mode);
+        std::set< std::string_view > named;
+        for (size_t i = 0; i < keymap.words.size(); i += 1) {
+            auto word = keymap.words[i];
+            if (word == 0) {
+                continue;
+            }
+            auto name = keyNamesByKeycode.find(word);
+            if (name != keyNamesByKeycode.end()
+                && named.insert(name->second).second) {
+                dict += fmt::format("{}: {}\n", name->second, i);
+            } else {
+                dict += fmt::format("# {}: 0x{:08x}\n", i, word);
+            }
+        }
+
+        auto keymapPath =
+            options.outputPath / fmt::format("default_keymap_{}.yml", suffix);
+        auto indicesPath =
+            options.outputPath / fmt::format("indices_{}.yml", suffix);
+        writeText(keymapPath, list);
+        writeText(indicesPath, dict);
+        written.push_back(keymapPath);
+        written.push_back(indicesPath);
+    }
+    return written;
+}
+
+static std::optional< uint8_t > parseRegion(const std::string &string) {
+    auto region = std::stoul(string, nullptr, 16);
+    if (region > 0xff) {
+        throw std::invalid_argument(string);
+    }
+    return uint8_t(region);
+}
+
+static uint32_t parseAddress(const std::string &string) {
+    // As Wireshark shows it: bus.device, or bus.device.endpoint
+    size_t end;
+    auto bus = std::stoul(string, &end);
+    if (end >= string.size() || string[end] != '.') {
+        throw std::invalid_argument(string);
+    }
+    auto device = std::stoul(string.substr(end + 1));
+    if (bus > 0xffff || device > 0xff) {
+        throw std::invalid_argument(string);
+    }
+    return uint32_t(bus << 8 | device);
+}
+
+static void printUsage(const char *argv0) {
+    p(stderr,
+      "Usage: {} [--device <bus>.<device>] [--win <region>] [--mac <region>] "
+      "<capture> <output directory>\n"
+      "Writes the default keymap and key indices of every keymap region "
+      "(e.g. d8) exchanged in a pcap or pcapng capture of usbmon traffic.\n"
+      "Regions passed with --win and --mac are named as under res/.\n",
+      argv0);
+}
+
+int main(int argc, char *argv[]) {
+    Options options;
+    std::vector< std::string > positional;
+    try {
+        for (int i = 1; i < argc; i += 1) {
+            auto argument = std::string(argv[i]);
+            auto hasValue = i + 1 < argc;
+            if (argument == "--device" && hasValue) {
+                options.address = parseAddress(argv[++i]);
+            } else if (argument == "--win" && hasValue) {
+                options.winRegion = parseRegion(argv[++i]);
+            } else if (argument == "--mac" && hasValue) {
+                options.macRegion = parseRegion(argv[++i]);
+            } else if (argument == "--help" || argument == "-h") {
+                printUsage(argv[0]);
+                return 0;
+            } else if (argument.rfind("--", 0) == 0) {
+                printUsage(argv[0]);
+                return 64;
+            } else {
+                positional.push_back(argument);
+            }
+        }
+    } catch (std::logic_error &) { // Thrown by std::stoul
+        printUsage(argv[0]);
+        return 64;
+    }
+    if (positional.size() != 2) {
+        printUsage(argv[0]);
+        return 64;
+    }
+    options.capturePath = positional[0];
+    options.outputPath = positional[1];
+
+    try {
+        auto start = std::chrono::steady_clock::now();
+
+        auto file = MappedFile::open(options.capturePath, true);
+        auto bytes = file->bytes();
+        Extractor extractor(options);
+        auto onPacket = [&](const Packet &packet) {
+            extractor.onPacket(packet);
+        };
+
+        uint32_t magic = 0;
+        if (bytes.size() >= 4) {
+            memcpy(&magic, bytes.data(), 4);
+        }
+        if (magic == 0x0a0d0d0a) {
+            readPcapng(bytes, onPacket);
+        } else if (magic == 0xa1b2c3d4 || magic == 0xd4c3b2a1
+                   || magic == 0xa1b23c4d || magic == 0x4d3cb2a1) {
+            readPcap(bytes, onPacket);
+        } else {
+            throw std::runtime_error(fmt::format(
+                "'{}' is neither a pcap nor a pcapng file.",
+                options.capturePath
+            ));
+        }
+
+        auto written = extractor.write();
+        auto seconds = std::chrono::duration< double >(
+                           std::chrono::steady_clock::now() - start
+        )
+                           .count();
+
+        auto &counters = extractor.getCounters();
+        p(stderr,
+          "Read {} packets ({} USB, {} feature reports) in {:.2f}s "
+          "({:.0f} MB/s): {} keymap reads, {} keymap writes.\n",
+          counters.packets,
+          counters.urbs,
+          counters.featureReports,
+          seconds,
+          bytes.size() / seconds / 1e6,
+          counters.keymapReads,
+          counters.keymapWrites);
+        if (written.empty()) {
+            p(stderr, "No keymaps found.\n");
+            return 1;
+        }
+        for (auto &path : written) {
+            p("{}\n", path.string());
+        }
+    } catch (std::runtime_error &e) { // Including filesystem errors
+        p(stderr, "[ERROR] {}\n", e.what());
+        return -1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,452 @@
+/*
+    Nudelta Console
+    Copyright (C) 2022 Mohamed Gaber
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include "ipc.hpp"
+#include "keymapfile.hpp"
+#include "nuphy.hpp"
+#include "pool.hpp"
+#include "registry.hpp"
+#include "stats.hpp"
+
+#include <atomic>
+#include <csignal>
+#include <fmt/format.h>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <ssco.hpp>
+#include <thread>
+#include <vector>
+
+#ifndef NUDELTA_VERSION
+    #define NUDELTA_VERSION "UNKNOWN"
+#endif
+
+// nudeltad keeps the keyboard list and an open session per keyboard around
+// between requests, so that a request costs little more than the reports it
+// exchanges with the keyboard. The list is kept current by hotplug events.
+
+static volatile std::sig_atomic_t stopping = 0;
+
+// A problem with the request itself, which no amount of retrying fixes.
+class request_error : public std::runtime_error {
+    public:
+        request_error(const std::string &what) : std::runtime_error(what) {}
+};
+
+// Requests are handled one at a time, whichever connection they arrive on,
+// as concurrent transfers to the same keyboard would interleave.
+static std::mutex requestMutex;
+static std::map< std::string, std::shared_ptr< NuPhy::Session > > sessions;
+
+static std::shared_ptr< NuPhy::Session >
+getSession(const std::shared_ptr< NuPhy > &keyboard) {
+    auto &session = sessions[keyboard->dataPath];
+    if (session == nullptr) {
+        session = keyboard->openSession();
+    }
+    return session;
+}
+
+// Runs `operation` over the keyboard's cached session. The session may have
+// gone stale, e.g. if the keyboard was replugged since it was opened, so on
+// failure it is reopened and the operation retried once.
+template < typename T >
+static T withSession(
+    const std::shared_ptr< NuPhy > &keyboard,
+    const std::function< T(std::shared_ptr< NuPhy::Session >) > &operation
+) {
+    try {
+        return operation(getSession(keyboard));
+    } catch (write_verification_error &) {
+        throw; // Already retried
+    } catch (request_error &) {
+        throw;
+    } catch (std::runtime_error &) {
+        sessions.erase(keyboard->dataPath);
+        DeviceRegistry::invalidate();
+        return operation(getSession(keyboard));
+    }
+}
+
+static std::string
+describeKeyboard(const std::shared_ptr< NuPhy > &keyboard) {
+    if (keyboard->dataPath == keyboard->requestPath) {
+        return fmt::format(
+            "Found NuPhy {} at path {} (Firmware {:04x})\n",
+            keyboard->getName(),
+            keyboard->dataPath,
+            keyboard->firmware
+        );
+    }
+    return fmt::format(
+        "Found NuPhy {} at paths ({}, {}) (Firmware {:04x})\n",
+        keyboard->getName(),
+        keyboard->dataPath,
+        keyboard->requestPath,
+        keyboard->firmware
+    );
+}
+
+static std::shared_ptr< NuPhy > getKeyboard(bool verify = true) {
+    auto keyboard = verify ? DeviceRegistry::get() : NuPhy::find(false);
+    if (keyboard == nullptr) {
+        throw std::runtime_error(
+            "Couldn't find a NuPhy keyboard connected to this device. Make sure it's plugged in via USB."
+        );
+    }
+    return keyboard;
+}
+
+// Applies `operation` to the first keyboard, or to every keyboard at once
+// with the "all-devices" flag, and describes the outcome.
+static IPC::Message forKeyboards(
+    bool allDevices,
+    const std::function< std::string(
+        std::shared_ptr< NuPhy >,
+        std::shared_ptr< NuPhy::Session >
+    ) > &operation
+) {
+    if (!allDevices) {
+        auto keyboard = getKeyboard();
+        auto result = withSession< std::string >(
+            keyboard,
+            [&](std::shared_ptr< NuPhy::Session > session) {
+                return operation(keyboard, session);
+            }
+        );
+        return {
+            "ok",
+            fmt::format("{}{}.\n", describeKeyboard(keyboard), result)};
+    }
+
+    auto keyboards = DeviceRegistry::getAll();
+    if (keyboards.empty()) {
+        throw std::runtime_error(
+            "Couldn't find any NuPhy keyboards connected to this device. Make sure they're plugged in via USB."
+        );
+    }
+
+    // Opened up front, as the session cache is not safe to touch from the
+    // workers
+    std::vector< std::shared_ptr< NuPhy::Session > > opened(keyboards.size());
+    std::vector< std::string > results(keyboards.size());
+    std::vector< std::optional< std::string > > errors(keyboards.size());
+    std::vector< char > stale(keyboards.size(), false);
+    for (size_t i = 0; i < keyboards.size(); i += 1) {
+        try {
+            opened[i] = getSession(keyboards[i]);
+        } catch (std::runtime_error &e) {
+            errors[i] = e.what();
+        }
+    }
+    parallelFor(keyboards.size(), [&](size_t i) {
+        if (opened[i] == nullptr) {
+            return;
+        }
+        try {
+            results[i] = operation(keyboards[i], opened[i]);
+        } catch (request_error &e) {
+            errors[i] = e.what();
+        } catch (std::runtime_error &e) {
+            errors[i] = e.what();
+            stale[i] = true;
+        }
+    });
+
+    std::string output;
+    size_t failures = 0;
+    for (size_t i = 0; i < keyboards.size(); i += 1) {
+        auto &keyboard = keyboards[i];
+        output += describeKeyboard(keyboard);
+        if (stale[i]) {
+            sessions.erase(keyboard->dataPath);
+            DeviceRegistry::invalidate();
+        }
+        if (errors[i].has_value()) {
+            failures += 1;
+            output += fmt::format(
+                "[{}] NuPhy {}: failed: {}\n",
+                keyboard->dataPath,
+                keyboard->getName(),
+                errors[i].value()
+            );
+        } else {
+            output += fmt::format(
+                "[{}] NuPhy {}: {}\n",
+                keyboard->dataPath,
+                keyboard->getName(),
+                results[i]
+            );
+        }
+    }
+
+    if (failures != 0) {
+        return {
+            "error",
+            fmt::format(
+                "{}The operation failed on {} of {} keyboards.",
+                output,
+                failures,
+                keyboards.size()
+            )};
+    }
+    return {"ok", output};
+}
+
+static bool
+hasFlag(const IPC::Message &request, size_t from, const char *flag) {
+    for (size_t i = from; i < request.size(); i += 1) {
+        if (request[i] == flag) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// apply <yaml> [force] [verify-writes] [all-devices]
+static IPC::Message apply(const IPC::Message &request) {
+    if (request.size() < 2) {
+        throw std::runtime_error("apply requires a profile.");
+    }
+    auto &yaml = request[1];
+    auto force = hasFlag(request, 2, "force");
+    auto verify = hasFlag(request, 2, "verify-writes");
+
+    return forKeyboards(
+        hasFlag(request, 2, "all-devices"),
+        [&](std::shared_ptr< NuPhy > keyboard,
+            std::shared_ptr< NuPhy::Session > session) {
+            std::optional< CompiledProfile > profile;
+            try {
+                profile = keyboard->compileYAMLKeymap(yaml);
+            } catch (std::runtime_error &e) {
+                throw request_error(e.what());
+            }
+            return NuPhy::describeDiffs(
+                keyboard->setKeymapFromProfile(*profile, session, force, verify)
+            );
+        }
+    );
+}
+
+// reset [force] [verify-writes] [all-devices]
+static IPC::Message reset(const IPC::Message &request) {
+    auto force = hasFlag(request, 1, "force");
+    auto verify = hasFlag(request, 1, "verify-writes");
+
+    return forKeyboards(
+        hasFlag(request, 1, "all-devices"),
+        [&](std::shared_ptr< NuPhy > keyboard,
+            std::shared_ptr< NuPhy::Session > session) {
+            return NuPhy::describeDiffs(
+                keyboard->resetKeymap(session, force, verify)
+            );
+        }
+    );
+}
+
+// dump [no-verify]: both keymaps are returned as a third field, as a keymap
+// file.
+static IPC::Message dump(const IPC::Message &request) {
+    auto keyboard = getKeyboard(!hasFlag(request, 1, "no-verify"));
+
+    auto bytes = withSession< std::vector< uint8_t > >(
+        keyboard,
+        [&](std::shared_ptr< NuPhy::Session > session) {
+            auto keymapWin = keyboard->readKeymap(false, *session).toVector();
+            auto keymapMac = keyboard->readKeymap(true, *session).toVector();
+            return KeymapFile::encode(
+                keyboard->getName(),
+                keyboard->firmware,
+                keymapWin,
+                keymapMac
+            );
+        }
+    );
+    return {
+        "ok",
+        describeKeyboard(keyboard),
+        std::string(bytes.begin(), bytes.end())};
+}
+
+// status: the connected keyboards, and the daemon's I/O statistics so far.
+static IPC::Message status(const IPC::Message &) {
+    std::string output;
+    auto keyboards = DeviceRegistry::getAll();
+    if (keyboards.empty()) {
+        output += "No NuPhy keyboards connected.\n";
+    }
+    for (auto &keyboard : keyboards) {
+        output += describeKeyboard(keyboard);
+    }
+    output += fmt::format(
+        "{} open session(s).\n\n{}",
+        sessions.size(),
+        Stats::format()
+    );
+    return {"ok", output};
+}
+
+static IPC::Message handle(const IPC::Message &request) {
+    static const std::map<
+        std::string,
+        std::function< IPC::Message(const IPC::Message &) > >
+        commands = {
+            {"apply", apply},
+            {"reset", reset},
+            {"dump", dump},
+            {"status", status}};
+
+    if (request.empty()) {
+        return {"error", "Empty request."};
+    }
+    auto command = commands.find(request[0]);
+    if (command == commands.end()) {
+        return {"error", fmt::format("Unknown command '{}'.", request[0])};
+    }
+
+    std::lock_guard< std::mutex > lock(requestMutex);
+    try {
+        return command->second(request);
+    } catch (std::exception &e) {
+        return {"error", e.what()};
+    }
+}
+
+// Connections served at once. Clients connect for a single command, so more
+// than a handful only happens if something is misbehaving.
+static const size_t MAX_CONNECTIONS = 16;
+
+// A connection served on its own thread, which sets `done` before it exits.
+struct Client {
+        std::shared_ptr< IPC::Connection > connection;
+        std::shared_ptr< std::atomic< bool > > done;
+        std::thread thread;
+};
+
+static void serve(
+    std::shared_ptr< IPC::Connection > connection,
+    std::shared_ptr< std::atomic< bool > > done
+) {
+    try {
+        while (auto request = connection->receive()) {
+            connection->send(handle(request.value()));
+        }
+    } catch (ipc_error &e) {
+        p(stderr, "[WARN] {}\n", e.what());
+    }
+    done->store(true);
+}
+
+static void joinFinished(std::vector< Client > &clients) {
+    for (auto it = clients.begin(); it != clients.end();) {
+        if (it->done->load()) {
+            it->thread.join();
+            it = clients.erase(it);
+        } else {
+            it++;
+        }
+    }
+}
+
+static void stop(int) {
+    stopping = 1;
+}
+
+SSCO_Fn(printVersion) {
+    p("Nudelta Daemon v{}\n", NUDELTA_VERSION);
+    p("Copyright (c) Mohamed Gaber 2022\n");
+}
+
+int main(int argc, char *argv[]) {
+    using Opt = SSCO::Option;
+
+    SSCO::Options options(
+        {Opt{"version",
+             'V',
+             "Show the current version of this app and exit.",
+             false,
+             printVersion},
+         Opt{"socket",
+             's',
+             "Listen on this socket instead of $NUDELTA_SOCKET or $XDG_RUNTIME_DIR/nudelta.sock.",
+             true}}
+    );
+
+    try {
+        auto opts = options.process(argc, argv);
+        if (!opts.has_value()) {
+            options.printHelp(std::cout);
+            return 1;
+        }
+        if (opts->options.find("version") != opts->options.end()) {
+            return 0;
+        }
+
+        auto socketIterator = opts->options.find("socket");
+        auto path = socketIterator != opts->options.end() ?
+            socketIterator->second :
+            IPC::getDefaultSocketPath();
+
+        std::signal(SIGINT, stop);
+        std::signal(SIGTERM, stop);
+
+        DeviceRegistry::watchHotplug();
+        IPC::Listener listener(path);
+        p("Listening on '{}'.\n", path);
+        fflush(stdout);
+
+        std::vector< Client > clients;
+        while (!stopping) {
+            std::shared_ptr< IPC::Connection > connection =
+                listener.accept(500);
+            joinFinished(clients);
+            if (connection == nullptr) {
+                continue;
+            }
+            if (clients.size() >= MAX_CONNECTIONS) {
+                try {
+                    connection->send(
+                        {"error", "The nudelta daemon is busy; try again."}
+                    );
+                } catch (ipc_error &) {
+                }
+                continue;
+            }
+            auto done = std::make_shared< std::atomic< bool > >(false);
+            clients.push_back(
+                {connection, done, std::thread(serve, connection, done)}
+            );
+        }
+
+        // Requests being handled are finished and answered, but no more are
+        // read, so nothing is cut off in the middle of a write to a keyboard
+        // or of a response.
+        for (auto &client : clients) {
+            client.connection->interrupt();
+        }
+        for (auto &client : clients) {
+            client.thread.join();
+        }
+    } catch (std::runtime_error &e) {
+        p(stderr, "[ERROR] {}\n", e.what());
+        return -1;
+    }
+
+    return 0;
+}
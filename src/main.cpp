@@ -16,12 +16,27 @@
     along with this program.  If not, see <https://www.gnu.org/licenses/>.
 */
 #include "access.hpp"
+#include "bank.hpp"
+#include "bindings.hpp"
+#include "hotplug.hpp"
+#include "ipc.hpp"
+#include "keymapfile.hpp"
 #include "nuphy.hpp"
-
+#include "pool.hpp"
+#include "stats.hpp"
+#include "trace.hpp"
+
+#include <condition_variable>
+#include <csignal>
+#include <filesystem>
+#include <fmt/format.h>
 #include <fstream>
 #include <hidapi.h>
 #include <iostream>
+#include <mutex>
 #include <scope_guard.hpp>
+#include <set>
+#include <sstream>
 #include <ssco.hpp>
 #ifdef _MSC_VER
     #include <BaseTsd.h>
@@ -35,14 +50,33 @@ typedef SSIZE_T ssize_t;
     #define NUDELTA_VERSION "UNKNOWN"
 #endif
 
-std::shared_ptr< NuPhy > getKeyboard(bool verify = true) {
-    auto keyboard = NuPhy::find(verify);
-    if (keyboard == nullptr) {
-        throw std::runtime_error(
-            "Couldn't find a NuPhy keyboard connected to this device. Make sure it's plugged in via USB."
-        );
+static std::optional< std::string > tracePath;
+static bool printStats = false;
+
+// Called first by every action that touches a keyboard or a profile, as the
+// options that only modify an action are not otherwise visible until it runs.
+void configureDiagnostics(const SSCO::Result &opts) {
+    auto traceIterator = opts.options.find("trace");
+    if (traceIterator != opts.options.end()) {
+        tracePath = traceIterator->second;
+        Trace::enable();
     }
+    printStats = opts.options.find("stats") != opts.options.end();
+}
 
+// Writes out whatever configureDiagnostics enabled, whether or not the action
+// succeeded.
+void flushDiagnostics() {
+    if (printStats) {
+        p("\n{}", Stats::format());
+    }
+    if (tracePath.has_value()) {
+        Trace::write(tracePath.value());
+        p(stderr, "Wrote trace to '{}'.\n", tracePath.value());
+    }
+}
+
+void printKeyboard(const std::shared_ptr< NuPhy > &keyboard) {
     if (keyboard->dataPath == keyboard->requestPath) {
         p("Found NuPhy {} at path {} (Firmware {:04x})\n",
           keyboard->getName(),
@@ -55,10 +89,106 @@ std::shared_ptr< NuPhy > getKeyboard(bool verify = true) {
           keyboard->requestPath,
           keyboard->firmware);
     }
+}
+
+std::shared_ptr< NuPhy > getKeyboard(bool verify = true) {
+    auto keyboard = NuPhy::find(verify);
+    if (keyboard == nullptr) {
+        throw std::runtime_error(
+            "Couldn't find a NuPhy keyboard connected to this device. Make sure it's plugged in via USB."
+        );
+    }
+
+    printKeyboard(keyboard);
 
     return keyboard;
 }
 
+// With --daemon, sends the request (plus whichever of `flags` were passed) to
+// nudeltad instead of opening the keyboard in this process, prints the reply
+// and returns it. Returns nullopt without --daemon.
+std::optional< IPC::Message > forwardToDaemon(
+    const SSCO::Result &opts,
+    IPC::Message request,
+    const std::vector< std::string > &flags = {}
+) {
+    if (opts.options.find("daemon") == opts.options.end()) {
+        return std::nullopt;
+    }
+    for (auto &flag : flags) {
+        if (opts.options.find(flag) != opts.options.end()) {
+            request.push_back(flag);
+        }
+    }
+
+    auto connection = IPC::Connection::connect(IPC::getDefaultSocketPath());
+    auto response = connection->call(request);
+    if (response.size() < 2) {
+        throw std::runtime_error("Received a malformed reply from nudeltad.");
+    }
+    if (response[0] != "ok") {
+        throw std::runtime_error(response[1]);
+    }
+    p("{}", response[1]);
+    return response;
+}
+
+// Runs `operation` on every connected keyboard at once, then reports the
+// outcome for each one. Throws if the operation failed on any keyboard.
+void forAllKeyboards(
+    const std::function< std::string(std::shared_ptr< NuPhy >) > &operation
+) {
+    auto keyboards = NuPhy::findAll();
+    if (keyboards.empty()) {
+        throw std::runtime_error(
+            "Couldn't find any NuPhy keyboards connected to this device. Make sure they're plugged in via USB."
+        );
+    }
+    for (auto &keyboard : keyboards) {
+        printKeyboard(keyboard);
+    }
+
+    std::vector< std::string > results(keyboards.size());
+    std::vector< std::optional< std::string > > errors(keyboards.size());
+    parallelFor(keyboards.size(), [&](size_t i) {
+        try {
+            results[i] = operation(keyboards[i]);
+        } catch (std::exception &e) {
+            errors[i] = e.what();
+        }
+    });
+
+    size_t failures = 0;
+    for (size_t i = 0; i < keyboards.size(); i += 1) {
+        auto &keyboard = keyboards[i];
+        if (errors[i].has_value()) {
+            failures += 1;
+            p(stderr,
+              "[{}] NuPhy {}: failed: {}\n",
+              keyboard->dataPath,
+              keyboard->getName(),
+              errors[i].value());
+        } else {
+            p("[{}] NuPhy {}: {}\n",
+              keyboard->dataPath,
+              keyboard->getName(),
+              results[i]);
+        }
+    }
+
+    if (failures != 0) {
+        throw std::runtime_error(fmt::format(
+            "The operation failed on {} of {} keyboards.",
+            failures,
+            keyboards.size()
+        ));
+    }
+}
+
+// Modifiers of load-profile and reset-keys that nudeltad understands as well
+static const std::vector< std::string > writeFlags =
+    {"force", "verify-writes", "all-devices"};
+
 SSCO_Fn(printVersion) {
     p("Nudelta Utility v{}\n", NUDELTA_VERSION);
     p("Copyright (c) Mohamed Gaber 2022\n");
@@ -72,112 +202,525 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 }
 
 SSCO_Fn(printFirmware) {
+    configureDiagnostics(opts);
+
+    if (forwardToDaemon(opts, {"status"})) {
+        return;
+    }
+
     auto keyboard = getKeyboard();
+    if (keyboard->serialNumber.has_value()) {
+        p("Serial number: {}\n", keyboard->serialNumber.value());
+    }
 }
 
 SSCO_Fn(resetKeymap) {
+    configureDiagnostics(opts);
+
+    auto force = opts.options.find("force") != opts.options.end();
+    auto verify = opts.options.find("verify-writes") != opts.options.end();
+
+    if (forwardToDaemon(opts, {"reset"}, writeFlags)) {
+        p("Wrote default keymap config through nudeltad.\n");
+        return;
+    }
+
+    if (opts.options.find("all-devices") != opts.options.end()) {
+        forAllKeyboards([&](std::shared_ptr< NuPhy > keyboard) {
+            return NuPhy::describeDiffs(
+                keyboard->resetKeymap(nullptr, force, verify)
+            );
+        });
+        p("Wrote default keymap config to every keyboard's Windows and Mac modes.\n");
+        return;
+    }
+
     auto keyboard = getKeyboard();
-    keyboard->resetKeymap();
+    auto diffs = keyboard->resetKeymap(nullptr, force, verify);
+    p("{}.\n", NuPhy::describeDiffs(diffs));
     p("Wrote default keymap config to the keyboard's Windows and Mac modes.\n");
 }
 
+// Written to a temporary file first, then moved into place, so processes
+// that still have the old file mapped (e.g. a bank) keep reading it intact.
+static void writeFile(
+    const std::filesystem::path &path,
+    const std::vector< uint8_t > &bytes
+) {
+    auto temporaryPath = path;
+    temporaryPath += ".tmp";
+    {
+        std::ofstream file(temporaryPath, std::ios::binary);
+        file.write((const char *)bytes.data(), bytes.size());
+        if (!file) {
+            throw std::runtime_error(
+                fmt::format("Failed to write '{}'.", path.string())
+            );
+        }
+    }
+    std::filesystem::rename(temporaryPath, path);
+}
+
 SSCO_Fn(dumpKeymap) {
+    configureDiagnostics(opts);
+
     auto mac = opts.options.find("mac") != opts.options.end();
     auto verify = opts.options.find("no-verify") == opts.options.end();
 
-    auto keyboard = getKeyboard(verify);
-    auto keys = keyboard->getKeymap(mac);
-    auto file = opts.options.find("dump-keys")->second;
-    auto filePtr = fopen(file.c_str(), "wb");
-
-    if (!filePtr) {
-        throw std::runtime_error(
-            fmt::format("Failed to open '{}' for writing", file)
+    std::vector< uint8_t > bytes;
+    auto response = forwardToDaemon(opts, {"dump"}, {"no-verify"});
+    if (response.has_value()) {
+        if (response->size() < 3) {
+            throw std::runtime_error("nudeltad did not return a keymap.");
+        }
+        auto &data = response->at(2);
+        bytes.assign(data.begin(), data.end());
+    } else {
+        auto keyboard = getKeyboard(verify);
+        auto session = keyboard->openSession();
+        auto keymapWin = keyboard->readKeymap(false, *session).toVector();
+        auto keymapMac = keyboard->readKeymap(true, *session).toVector();
+        bytes = KeymapFile::encode(
+            keyboard->getName(),
+            keyboard->firmware,
+            keymapWin,
+            keymapMac
         );
     }
 
-    SCOPE_EXIT {
-        fclose(filePtr);
-    };
-
-    // ALERT: Endianness-defined Behavior
-    auto seeker = (char *)keys.data();
-    auto end = (char *)(keys.data() + keys.size());
-    fwrite(seeker, 1, end - seeker, filePtr);
-
-    p("Wrote current {} keymap to '{}'.\n", mac ? "Mac" : "Windows", file);
+    auto file = opts.options.find("dump-keys")->second;
+    writeFile(file, bytes);
+    p("Wrote current Windows and Mac keymaps to '{}'.\n", file);
 
     auto hexFileIterator = opts.options.find("dump-hex-to");
     if (hexFileIterator != opts.options.end()) {
         auto hexFile = hexFileIterator->second;
-        auto hexFilePtr = fopen(hexFile.c_str(), "w");
-        if (!hexFilePtr) {
-            throw std::runtime_error(
-                fmt::format("Failed to open '{}' for writing", hexFile)
+        auto keymapFile = KeymapFile::fromBytes(std::move(bytes));
+        auto keys = keymapFile->getKeymap(mac).bytes();
+
+        std::vector< std::string > annotations;
+        if (opts.options.find("annotate") != opts.options.end()) {
+            // Annotated with the tables of the model the dump came from
+            auto model = NuPhy::forModel(keymapFile->getModel());
+            annotations = model->annotateKeymap(
+                keymapFile->getKeymap(mac).toVector(),
+                mac
             );
         }
-        SCOPE_EXIT {
-            fclose(hexFilePtr);
-        };
 
-        prettyPrintBinary(
-            std::vector< uint8_t >(
-                (uint8_t *)keys.data(),
-                (uint8_t *)(keys.data() + keys.size())
-            ),
-            hexFilePtr
-        );
+        auto hex = formatBinary(keys.data(), keys.size(), annotations);
+        writeFile(hexFile, std::vector< uint8_t >(hex.begin(), hex.end()));
 
-        p("Wrote current keymap in hex format to '{}'.\n", hexFile);
+        p("Wrote current {} keymap in hex format to '{}'.\n",
+          mac ? "Mac" : "Windows",
+          hexFile);
     }
 }
 
 SSCO_Fn(loadKeymap) {
+    configureDiagnostics(opts);
+
     auto mac = opts.options.find("mac") != opts.options.end();
+    auto force = opts.options.find("force") != opts.options.end();
+    auto verify = opts.options.find("verify-writes") != opts.options.end();
+
+    auto path = opts.options.find("load-keys")->second;
+    auto file = KeymapFile::open(path);
 
     auto keyboard = getKeyboard();
-    auto keys = keyboard->getKeymap(mac);
-    auto file = opts.options.find("load-keys")->second;
-    auto filePtr = fopen(file.c_str(), "rb");
-    if (!filePtr) {
-        throw std::runtime_error(
-            fmt::format("Failed to open '{}' for reading", file)
-        );
+    auto session = keyboard->openSession();
+
+    if (file->isRaw()) {
+        // Raw dumps do not say which mode or model they came from, so the
+        // size is all there is to check
+        auto expected = keyboard->getDefaultKeymap(mac).size();
+        if (file->getKeymap(mac).size() != expected) {
+            throw std::runtime_error(fmt::format(
+                "'{}' holds {} keys, but the NuPhy {} has {}.",
+                path,
+                file->getKeymap(mac).size(),
+                keyboard->getName(),
+                expected
+            ));
+        }
+        auto keymap = file->getKeymap(mac).toVector();
+        keyboard->setKeymap(keymap, mac, session, verify);
+
+        p("Wrote {}keymap '{}' to the keyboard's {} mode.\n",
+          verify ? "and verified " : "",
+          path,
+          mac ? "Mac" : "Windows");
+        return;
     }
-    SCOPE_EXIT {
-        fclose(filePtr);
-    };
 
-    uint8_t readBuffer[1024];
-    ssize_t readResult = fread(readBuffer, 1, sizeof readBuffer, filePtr);
-    if (readResult < 0) {
-        throw std::runtime_error("Failed to read the keymap file.");
+    if (file->getModel() != keyboard->getName()) {
+        throw std::runtime_error(fmt::format(
+            "'{}' holds keymaps for the NuPhy {}, not the NuPhy {}.",
+            path,
+            file->getModel(),
+            keyboard->getName()
+        ));
     }
 
-    // ALERT: Endianness-defined Behavior
-    auto keymap = std::vector< uint32_t >(
-        (uint32_t *)readBuffer,
-        (uint32_t *)(readBuffer + 1024)
-    );
-
-    keyboard->setKeymap(keymap, mac);
-
-    p("Wrote keymap '{}' to the keyboard's {} mode.\n",
-      file,
-      mac ? "Mac" : "Windows");
+    std::vector< NuPhy::KeymapDiff > diffs;
+    for (auto mode : {false, true}) {
+        if (file->hasKeymap(mode)) {
+            diffs.push_back(keyboard->applyKeymap(
+                file->getKeymap(mode).toVector(),
+                mode,
+                session,
+                force,
+                verify
+            ));
+        }
+    }
+    p("{}.\n", NuPhy::describeDiffs(diffs));
+    p("Wrote keymap file '{}' to the keyboard.\n", path);
 }
 
 SSCO_Fn(loadYAML) {
-    auto keyboard = getKeyboard();
+    configureDiagnostics(opts);
+
+    auto force = opts.options.find("force") != opts.options.end();
+    auto verify = opts.options.find("verify-writes") != opts.options.end();
     auto configPath = opts.options.find("load-profile")->second;
 
     std::string configStr;
     std::getline(std::ifstream(configPath), configStr, '\0');
-    keyboard->setKeymapFromYAML(configStr);
+
+    if (forwardToDaemon(opts, {"apply", configStr}, writeFlags)) {
+        p("Wrote keymap '{}' through nudeltad.\n", configPath);
+        return;
+    }
+
+    if (opts.options.find("all-devices") != opts.options.end()) {
+        forAllKeyboards([&](std::shared_ptr< NuPhy > keyboard) {
+            return NuPhy::describeDiffs(
+                keyboard->setKeymapFromYAML(configStr, nullptr, force, verify)
+            );
+        });
+        p("Wrote keymap '{}' to every keyboard.\n", configPath);
+        return;
+    }
+
+    auto keyboard = getKeyboard();
+    auto diffs =
+        keyboard->setKeymapFromYAML(configStr, nullptr, force, verify);
+    p("{}.\n", NuPhy::describeDiffs(diffs));
 
     p("Wrote keymap '{}' to the keyboard.\n", configPath);
 }
 
+SSCO_Fn(useProfile) {
+    configureDiagnostics(opts);
+
+    auto force = opts.options.find("force") != opts.options.end();
+    auto verify = opts.options.find("verify-writes") != opts.options.end();
+    auto name = opts.options.find("use")->second;
+    auto bankIterator = opts.options.find("bank");
+    if (bankIterator == opts.options.end()) {
+        throw std::runtime_error(
+            "--use requires the profile bank to be passed with --bank."
+        );
+    }
+    auto bank = ProfileBank::open(bankIterator->second);
+
+    if (opts.options.find("all-devices") != opts.options.end()) {
+        forAllKeyboards([&](std::shared_ptr< NuPhy > keyboard) {
+            return NuPhy::describeDiffs(
+                keyboard->setKeymapFromBank(*bank, name, nullptr, force, verify)
+            );
+        });
+        p("Wrote profile '{}' to every keyboard.\n", name);
+        return;
+    }
+
+    auto keyboard = getKeyboard();
+    auto diffs =
+        keyboard->setKeymapFromBank(*bank, name, nullptr, force, verify);
+    p("{}.\n", NuPhy::describeDiffs(diffs));
+    p("Wrote profile '{}' to the keyboard.\n", name);
+}
+
+// Only reached if neither use nor compile is passed along with the bank
+SSCO_Fn(listProfiles) {
+    configureDiagnostics(opts);
+
+    auto bankPath = opts.options.find("bank")->second;
+    auto bank = ProfileBank::open(bankPath);
+    for (auto &[name, model] : bank->list()) {
+        p("{} ({})\n", name, model);
+    }
+    p("{} profiles in '{}'.\n", bank->size(), bankPath);
+}
+
+static volatile std::sig_atomic_t stopWatching = 0;
+
+// Applies the bound profile to every connected keyboard, or only to those
+// at `paths` if passed. As the current keymaps are read back first,
+// keyboards that already hold their profile are not written to.
+static void applyBindings(
+    const ProfileBindings &bindings,
+    const std::optional< std::set< std::string > > &paths,
+    bool verify
+) {
+    std::vector< std::shared_ptr< NuPhy > > keyboards;
+    try {
+        keyboards = NuPhy::findAll();
+    } catch (std::exception &e) {
+        // A keyboard that was just plugged in may not be readable yet; the
+        // next event gives it another chance.
+        p(stderr, "Failed to enumerate keyboards: {}\n", e.what());
+        return;
+    }
+    for (auto &keyboard : keyboards) {
+        if (paths.has_value() && paths->count(keyboard->dataPath) == 0
+            && paths->count(keyboard->requestPath) == 0) {
+            continue;
+        }
+        auto serialNumber = keyboard->serialNumber.value_or("no serial");
+        auto binding = bindings.find(*keyboard);
+        if (binding == nullptr) {
+            p("[{}] NuPhy {} ({}): no profile bound, skipped.\n",
+              keyboard->dataPath,
+              keyboard->getName(),
+              serialNumber);
+            continue;
+        }
+        try {
+            auto diffs = keyboard->setKeymapFromYAML(
+                binding->yaml,
+                nullptr,
+                false,
+                verify
+            );
+            p("[{}] NuPhy {} ({}): '{}': {}.\n",
+              keyboard->dataPath,
+              keyboard->getName(),
+              serialNumber,
+              binding->profilePath,
+              NuPhy::describeDiffs(diffs));
+        } catch (std::exception &e) {
+            p(stderr,
+              "[{}] NuPhy {} ({}): failed to apply '{}': {}\n",
+              keyboard->dataPath,
+              keyboard->getName(),
+              serialNumber,
+              binding->profilePath,
+              e.what());
+        }
+    }
+}
+
+SSCO_Fn(watchBindings) {
+    configureDiagnostics(opts);
+
+    auto verify = opts.options.find("verify-writes") != opts.options.end();
+    auto bindingsPath = opts.options.find("watch")->second;
+    auto bindings = ProfileBindings::load(bindingsPath);
+
+    std::mutex mutex;
+    std::condition_variable attached;
+    std::set< std::string > pending;
+    HotplugMonitor monitor([&](const HotplugEvent &event) {
+        if (!event.attached) {
+            return;
+        }
+        std::lock_guard< std::mutex > lock(mutex);
+        pending.insert(event.path);
+        attached.notify_one();
+    });
+
+    std::signal(SIGINT, [](int) { stopWatching = 1; });
+    std::signal(SIGTERM, [](int) { stopWatching = 1; });
+
+    p("Loaded {} bindings from '{}'. Watching for keyboards until interrupted.\n",
+      bindings.size(),
+      bindingsPath);
+    applyBindings(bindings, std::nullopt, verify);
+
+    while (!stopWatching) {
+        std::set< std::string > paths;
+        {
+            std::unique_lock< std::mutex > lock(mutex);
+            // Woken periodically to notice being interrupted
+            attached.wait_for(lock, std::chrono::milliseconds(250), [&] {
+                return !pending.empty();
+            });
+            std::swap(paths, pending);
+        }
+        if (!paths.empty()) {
+            applyBindings(bindings, paths, verify);
+        }
+    }
+}
+
+static std::vector< std::filesystem::path >
+findProfiles(const std::filesystem::path &input) {
+    std::vector< std::filesystem::path > paths;
+    if (!std::filesystem::is_directory(input)) {
+        paths.push_back(input);
+        return paths;
+    }
+    for (auto &entry : std::filesystem::recursive_directory_iterator(input)) {
+        auto extension = entry.path().extension();
+        if (entry.is_regular_file()
+            && (extension == ".yml" || extension == ".yaml")) {
+            paths.push_back(entry.path());
+        }
+    }
+    std::sort(paths.begin(), paths.end());
+    return paths;
+}
+
+SSCO_Fn(compileProfiles) {
+    configureDiagnostics(opts);
+
+    auto input = std::filesystem::path(opts.options.find("compile")->second);
+    auto modelIterator = opts.options.find("model");
+    if (modelIterator == opts.options.end()) {
+        throw std::runtime_error(
+            "--compile requires the keyboard model to be passed with --model."
+        );
+    }
+    // Several models may be passed, separated by commas, e.g. to build one
+    // bank for all of them
+    std::vector< std::shared_ptr< NuPhy > > keyboards;
+    std::stringstream models(modelIterator->second);
+    for (std::string model; std::getline(models, model, ',');) {
+        keyboards.push_back(NuPhy::forModel(model));
+    }
+    auto multipleModels = keyboards.size() > 1;
+
+    std::optional< std::filesystem::path > output;
+    auto outputIterator = opts.options.find("output");
+    if (outputIterator != opts.options.end()) {
+        output = outputIterator->second;
+    }
+    std::optional< std::string > bankPath;
+    auto bankIterator = opts.options.find("bank");
+    if (bankIterator != opts.options.end()) {
+        bankPath = bankIterator->second;
+    }
+
+    auto paths = findProfiles(input);
+    std::vector< std::string > names;
+    for (auto &path : paths) {
+        auto relative = std::filesystem::is_directory(input) ?
+            std::filesystem::relative(path, input) :
+            path.filename();
+        names.push_back(relative.replace_extension().generic_string());
+    }
+
+    // One job per profile per model
+    auto jobs = paths.size() * keyboards.size();
+    std::vector< std::vector< NuPhy::Diagnostic > > diagnostics(jobs);
+    std::vector< std::optional< CompiledProfile > > profiles(jobs);
+    parallelFor(jobs, [&](size_t job) {
+        auto i = job % paths.size();
+        auto &keyboard = keyboards[job / paths.size()];
+        try {
+            std::string configStr;
+            std::ifstream file(paths[i]);
+            if (!file) {
+                throw std::runtime_error("Failed to open file for reading.");
+            }
+            std::getline(file, configStr, '\0');
+
+            diagnostics[job] = keyboard->diagnoseYAMLKeymap(configStr);
+            if (!diagnostics[job].empty()
+                || (!output.has_value() && !bankPath.has_value())) {
+                return;
+            }
+
+            profiles[job] = keyboard->compileYAMLKeymap(configStr, false);
+            if (output.has_value()) {
+                auto directory = multipleModels ?
+                    output.value() / keyboard->getName() :
+                    output.value();
+                auto target = directory / (names[i] + ".ndk");
+                std::filesystem::create_directories(target.parent_path());
+                writeFile(target, KeymapFile::encode(profiles[job].value()));
+            }
+        } catch (std::exception &e) {
+            diagnostics[job].push_back({e.what(), 0, 0});
+        }
+    });
+
+    std::vector< std::string > failures;
+    for (size_t first = 0; first < jobs; first += paths.size()) {
+        auto &keyboard = keyboards[first / paths.size()];
+        size_t invalid = 0;
+        for (size_t i = 0; i < paths.size(); i += 1) {
+            auto &found = diagnostics[first + i];
+            if (found.empty()) {
+                continue;
+            }
+            invalid += 1;
+            for (auto &diagnostic : found) {
+                auto message = multipleModels ?
+                    fmt::format(
+                        "{} (NuPhy {})",
+                        diagnostic.message,
+                        keyboard->getName()
+                    ) :
+                    diagnostic.message;
+                if (diagnostic.line == 0) {
+                    p(stderr, "{}: {}\n", paths[i].string(), message);
+                } else {
+                    p(stderr,
+                      "{}:{}:{}: {}\n",
+                      paths[i].string(),
+                      diagnostic.line,
+                      diagnostic.column,
+                      message);
+                }
+            }
+        }
+        if (invalid != 0) {
+            failures.push_back(fmt::format(
+                "{} of {} profiles are invalid for the NuPhy {}.",
+                invalid,
+                paths.size(),
+                keyboard->getName()
+            ));
+        }
+    }
+
+    if (!failures.empty()) {
+        throw std::runtime_error(fmt::format("{}", fmt::join(failures, " ")));
+    }
+
+    std::vector< std::string > modelNames;
+    for (auto &keyboard : keyboards) {
+        modelNames.push_back("NuPhy " + keyboard->getName());
+    }
+    auto target = fmt::format("{}", fmt::join(modelNames, ", "));
+
+    if (bankPath.has_value()) {
+        std::vector< ProfileBank::Entry > entries;
+        for (size_t job = 0; job < jobs; job += 1) {
+            entries.push_back(
+                {names[job % paths.size()], profiles[job].value()}
+            );
+        }
+        writeFile(bankPath.value(), ProfileBank::build(entries));
+        p("Wrote {} profiles for the {} to bank '{}'.\n",
+          paths.size(),
+          target,
+          bankPath.value());
+    }
+
+    if (output.has_value()) {
+        p("Compiled {} profiles for the {} to '{}'.\n",
+          paths.size(),
+          target,
+          output->string());
+    } else if (!bankPath.has_value()) {
+        p("All {} profiles are valid for the {}.\n", paths.size(), target);
+    }
+}
+
 int main(int argc, char *argv[]) {
     using Opt = SSCO::Option;
 
@@ -198,9 +741,38 @@ int main(int argc, char *argv[]) {
              "Restore the original keymap.",
              false,
              resetKeymap},
+         Opt{"all-devices",
+             'A',
+             "Valid only if load-profile, reset-keys or use are passed: operate on every connected keyboard at once.",
+             false},
+         Opt{"force",
+             'F',
+             "Valid only if load-profile, reset-keys, load-keys or use are passed: write every mode even if the keyboard already holds the same keymap.",
+             false},
+         Opt{"verify-writes",
+             'W',
+             "Valid only if load-profile, reset-keys, load-keys, use or watch are passed: read every written mode back and retry writes that do not match.",
+             false},
+         Opt{"watch",
+             'w',
+             "Apply the profiles bound to keyboards' serial numbers or paths in this YAML file to every keyboard connected now, then to each keyboard as it is plugged in, until interrupted.",
+             true,
+             watchBindings},
+         Opt{"daemon",
+             'd',
+             "Valid only if firmware, load-profile, reset-keys or dump-keys are passed: have a running nudeltad do the work over the socket at $NUDELTA_SOCKET or $XDG_RUNTIME_DIR/nudelta.sock. With firmware, prints the daemon's status.",
+             false},
+         Opt{"trace",
+             'T',
+             "Record how long every phase of the operation (enumeration, opening devices, each report, YAML parsing, etc.) took to this file, in the Chrome trace event format.",
+             true},
+         Opt{"stats",
+             'S',
+             "Print counters and latency statistics for device I/O and profile compilation once done.",
+             false},
          Opt{"mac",
              'M',
-             "Valid only if dump-keys or load-keys are passed: operate on the Mac mode of the keyboard instead of the Win mode.",
+             "Valid only if dump-hex-to is passed, or load-keys with a raw keymap: operate on the Mac mode of the keyboard instead of the Win mode.",
              false},
          Opt{"no-verify",
              'N',
@@ -208,20 +780,48 @@ int main(int argc, char *argv[]) {
              false},
          Opt{"dump-keys",
              'D',
-             "Dump the keymap to a binary file.",
+             "Dump both of the keyboard's keymaps to a keymap file.",
              true,
              dumpKeymap},
          Opt{"dump-hex-to",
              'H',
              "When the keymap is dumped to a binary file, also dump the keymap in a hex format to a text file.",
              true},
+         Opt{"annotate",
+             'a',
+             "Valid only if dump-hex-to is passed: end each word's line with the key it belongs to and the keycode it holds.",
+             false},
          Opt{"load-keys",
              'L',
-             "Load the keymap from a binary file.",
+             "Load the keymaps from a keymap file, or a raw keymap as dumped by earlier versions.",
+             true,
+             loadKeymap},
+         Opt{"compile",
+             'C',
+             "Validate every YAML profile in a directory (or a single profile) without a keyboard, reporting every error found. Requires --model.",
+             true,
+             compileProfiles},
+         Opt{"use",
+             'u',
+             "Write the profile with this name from the bank passed with --bank to the keyboard.",
              true,
-             loadKeymap}}
+             useProfile},
+         Opt{"bank",
+             'b',
+             "The profile bank to read from with use, or with compile, to write every profile to. Alone, lists the bank's profiles and the model each is for.",
+             true,
+             listProfiles},
+         Opt{"model",
+             'm',
+             "Valid only if compile is passed: the keyboard model to compile for, e.g. Air75 or Halo75, or several separated by commas.",
+             true},
+         Opt{"output",
+             'o',
+             "Valid only if compile is passed: also write each profile's keymaps to a keymap file (as used by load-keys) under this directory.",
+             true}}
     );
 
+    int status = 0;
     try {
         auto opts = options.process(argc, argv);
 
@@ -229,15 +829,23 @@ int main(int argc, char *argv[]) {
             if (!opts.value().options.size()) {
                 options.printHelp(std::cout);
             }
-            return 0;
         } else {
             options.printHelp(std::cout);
-            return 1;
+            status = 1;
         }
     } catch (std::runtime_error &e) {
         p(stderr, "[ERROR] {}\n", e.what());
-        return -1;
+        status = -1;
+    }
+
+    try {
+        flushDiagnostics();
+    } catch (std::runtime_error &e) {
+        p(stderr, "[ERROR] {}\n", e.what());
+        if (status == 0) {
+            status = -1;
+        }
     }
 
-    return 0;
+    return status;
 }
\ No newline at end of file
@@ -16,36 +16,73 @@
     along with this program.  If not, see <https://www.gnu.org/licenses/>.
 */
 #include "access.hpp"
+#include "bank.hpp"
+#include "hotplug.hpp"
 #include "nuphy.hpp"
+#include "registry.hpp"
+#include "stats.hpp"
+#include "validator.hpp"
 
+#include <atomic>
+#include <filesystem>
+#include <mutex>
 #include <napi.h>
+#include <unordered_map>
 
 using namespace Napi;
 
-Napi::Value getKeyboardInfo(const Napi::CallbackInfo &info) {
-    Napi::Env env = info.Env();
-    try {
-        auto keyboard = NuPhy::find();
-        if (keyboard == nullptr) {
-            return env.Null();
+// The registry watches for hotplug events, so that it can cache empty
+// results too, but only once devices are first used: starting the monitor
+// initializes hidapi, which loading the addon must not.
+static void watchDevices() {
+    static std::once_flag started;
+    std::call_once(started, []() {
+        try {
+            DeviceRegistry::watchHotplug();
+        } catch (std::runtime_error &e) {
+            // Not fatal: the registry then just doesn't cache empty results
         }
+    });
+}
 
-        auto string = fmt::format(
-            "NuPhy {} (Firmware {:04x})",
-            keyboard->getName(),
-            keyboard->firmware
-        );
+static std::shared_ptr< NuPhy > getConnectedKeyboard() {
+    watchDevices();
+    return DeviceRegistry::get();
+}
 
-        if (keyboard->dataPath == keyboard->requestPath
-            && keyboard->dataPath.length() <= 20) {
-            string = fmt::format("{} at {}", string, keyboard->dataPath);
-        }
+static std::string
+describeKeyboard(const std::shared_ptr< NuPhy > &keyboard) {
+    auto string = fmt::format(
+        "NuPhy {} (Firmware {:04x})",
+        keyboard->getName(),
+        keyboard->firmware
+    );
 
-        auto object = Napi::Object::New(env);
-        object["info"] = Napi::String::New(env, string);
-        object["kind"] = Napi::String::New(env, keyboard->getName());
+    if (keyboard->dataPath == keyboard->requestPath
+        && keyboard->dataPath.length() <= 20) {
+        string = fmt::format("{} at {}", string, keyboard->dataPath);
+    }
 
-        return object;
+    return string;
+}
+
+static Napi::Value
+keyboardInfoObject(Napi::Env env, const std::shared_ptr< NuPhy > &keyboard) {
+    if (keyboard == nullptr) {
+        return env.Null();
+    }
+
+    auto object = Napi::Object::New(env);
+    object["info"] = Napi::String::New(env, describeKeyboard(keyboard));
+    object["kind"] = Napi::String::New(env, keyboard->getName());
+
+    return object;
+}
+
+Napi::Value getKeyboardInfo(const Napi::CallbackInfo &info) {
+    Napi::Env env = info.Env();
+    try {
+        return keyboardInfoObject(env, getConnectedKeyboard());
     } catch (permissions_error &e) {
         auto error = Napi::Error::New(env, e.what());
         auto exception = error.Value();
@@ -60,26 +97,85 @@ Napi::Value getKeyboardInfo(const Napi::CallbackInfo &info) {
     return env.Null();
 }
 
+// Profiles are validated against `model` if one is passed, so no keyboard
+// needs to be connected, and against the connected keyboard otherwise.
+static std::shared_ptr< NuPhy >
+getValidatingKeyboard(const std::optional< std::string > &model) {
+    if (model.has_value()) {
+        return NuPhy::forModel(model.value());
+    }
+    auto keyboard = getConnectedKeyboard();
+    if (keyboard == nullptr) {
+        throw std::runtime_error("The keyboard was unplugged.");
+    }
+    return keyboard;
+}
+
+// Report exchanges with one keyboard must not interleave, and exports may be
+// called again before an earlier worker is done with the keyboard, so every
+// session is held under its keyboard's lock from start to end.
+static std::unique_lock< std::mutex >
+lockKeyboard(const std::shared_ptr< NuPhy > &keyboard) {
+    static std::mutex mutex;
+    static std::unordered_map< std::string, std::unique_ptr< std::mutex > >
+        keyboardMutexes;
+
+    std::mutex *keyboardMutex;
+    {
+        std::lock_guard< std::mutex > lock(mutex);
+        auto &entry = keyboardMutexes[keyboard->dataPath];
+        if (entry == nullptr) {
+            entry = std::make_unique< std::mutex >();
+        }
+        keyboardMutex = entry.get();
+    }
+    return std::unique_lock< std::mutex >(*keyboardMutex);
+}
+
+static std::optional< std::string >
+getOptionalString(const Napi::CallbackInfo &info, size_t i) {
+    if (info.Length() <= i || !info[i].IsString()) {
+        return std::nullopt;
+    }
+    return info[i].As< Napi::String >().Utf8Value();
+}
+
+// Throws the first of `diagnostics`, if any.
+static void
+throwFirstDiagnostic(const std::vector< NuPhy::Diagnostic > &diagnostics) {
+    if (!diagnostics.empty()) {
+        throw std::runtime_error(diagnostics.front().message);
+    }
+}
+
+static Napi::Array
+diagnosticsArray(Napi::Env env, const std::vector< NuPhy::Diagnostic > &list) {
+    auto array = Napi::Array::New(env, list.size());
+    for (uint32_t i = 0; i < list.size(); i += 1) {
+        auto object = Napi::Object::New(env);
+        object["message"] = Napi::String::New(env, list[i].message);
+        object["line"] = Napi::Number::New(env, list[i].line);
+        object["column"] = Napi::Number::New(env, list[i].column);
+        array[i] = object;
+    }
+    return array;
+}
+
 Napi::Value validateYAML(const Napi::CallbackInfo &info) {
     Napi::Env env = info.Env();
     try {
         if (info.Length() < 1 || !info[0].IsString()) {
             Napi::TypeError::New(
                 env,
-                "Internal error: validateYAML takes exactly one string argument"
+                "Internal error: validateYAML takes a string argument and an optional model name"
             )
                 .ThrowAsJavaScriptException();
             return env.Null();
         }
 
-        auto keyboard = NuPhy::find();
-        if (keyboard == nullptr) {
-            throw std::runtime_error("The keyboard was unplugged.");
-        }
-
+        auto keyboard = getValidatingKeyboard(getOptionalString(info, 1));
         auto keymapYAML = info[0].As< Napi::String >().Utf8Value();
-        keyboard->validateYAMLKeymap(keymapYAML, false, false);
-        keyboard->validateYAMLKeymap(keymapYAML, false, true);
+        throwFirstDiagnostic(keyboard->diagnoseYAMLKeymap(keymapYAML, false));
 
     } catch (std::runtime_error &e) {
         Napi::Error::New(env, e.what()).ThrowAsJavaScriptException();
@@ -87,6 +183,48 @@ Napi::Value validateYAML(const Napi::CallbackInfo &info) {
     return env.Null();
 }
 
+// createValidator(model?: string)
+// Returns a function that takes successive versions of a profile being
+// edited and returns every problem in each as {message, line, column}, with
+// 1-based lines and columns (0 if unknown). Only the entries that changed
+// since the previous version are checked again, and without a model, the
+// connected keyboard's is used.
+Napi::Value createValidator(const Napi::CallbackInfo &info) {
+    Napi::Env env = info.Env();
+    std::shared_ptr< IncrementalValidator > validator;
+    try {
+        validator = std::make_shared< IncrementalValidator >(
+            getValidatingKeyboard(getOptionalString(info, 0)),
+            false
+        );
+    } catch (std::runtime_error &e) {
+        Napi::Error::New(env, e.what()).ThrowAsJavaScriptException();
+        return env.Null();
+    }
+
+    auto update = [validator](const Napi::CallbackInfo &info) {
+        Napi::Env env = info.Env();
+        if (info.Length() < 1 || !info[0].IsString()) {
+            Napi::TypeError::New(
+                env,
+                "Internal error: validators take exactly one string argument"
+            )
+                .ThrowAsJavaScriptException();
+            return env.Null();
+        }
+        try {
+            auto keymapYAML = info[0].As< Napi::String >().Utf8Value();
+            return Napi::Value(
+                diagnosticsArray(env, validator->update(keymapYAML))
+            );
+        } catch (std::runtime_error &e) {
+            Napi::Error::New(env, e.what()).ThrowAsJavaScriptException();
+        }
+        return env.Null();
+    };
+    return Napi::Function::New(env, update);
+}
+
 Napi::Value setKeymapFromYAML(const Napi::CallbackInfo &info) {
     Napi::Env env = info.Env();
     try {
@@ -108,12 +246,13 @@ Napi::Value setKeymapFromYAML(const Napi::CallbackInfo &info) {
             return env.Null();
         }
 
-        auto keyboard = NuPhy::find();
+        auto keyboard = getConnectedKeyboard();
         if (keyboard == nullptr) {
             throw std::runtime_error("The keyboard was unplugged.");
         }
 
         auto keymapYAML = info[0].As< Napi::String >().Utf8Value();
+        auto lock = lockKeyboard(keyboard);
         keyboard->setKeymapFromYAML(keymapYAML);
     } catch (permissions_error &e) {
         auto error = Napi::Error::New(env, e.what());
@@ -129,7 +268,439 @@ Napi::Value setKeymapFromYAML(const Napi::CallbackInfo &info) {
     return env.Null();
 }
 
+// Banks stay mapped between calls, so switching profiles costs a lookup and
+// the writes to the keyboard. A bank is reopened once its file is replaced.
+static std::shared_ptr< ProfileBank > getBank(const std::string &path) {
+    static std::mutex mutex;
+    using Opened = std::pair<
+        std::filesystem::file_time_type,
+        std::shared_ptr< ProfileBank > >;
+    static std::unordered_map< std::string, Opened > banks;
+
+    auto modified = std::filesystem::last_write_time(path);
+    std::lock_guard< std::mutex > lock(mutex);
+    auto &bank = banks[path];
+    if (bank.second == nullptr || bank.first != modified) {
+        bank = {modified, ProfileBank::open(path)};
+    }
+    return bank.second;
+}
+
+Napi::Value setKeymapFromBank(const Napi::CallbackInfo &info) {
+    Napi::Env env = info.Env();
+    try {
+        if (info.Length() < 2 || !info[0].IsString() || !info[1].IsString()) {
+            Napi::TypeError::New(
+                env,
+                "Internal error: setKeymapFromBank takes a bank path and a profile name"
+            )
+                .ThrowAsJavaScriptException();
+            return env.Null();
+        }
+
+        auto keyboard = getConnectedKeyboard();
+        if (keyboard == nullptr) {
+            throw std::runtime_error("The keyboard was unplugged.");
+        }
+
+        auto bank = getBank(info[0].As< Napi::String >().Utf8Value());
+        auto lock = lockKeyboard(keyboard);
+        keyboard->setKeymapFromBank(
+            *bank,
+            info[1].As< Napi::String >().Utf8Value()
+        );
+    } catch (permissions_error &e) {
+        auto error = Napi::Error::New(env, e.what());
+        auto exception = error.Value();
+        exception["kind"] = "Permissions Error";
+        napi_throw(env, exception);
+    } catch (std::runtime_error &e) {
+        auto error = Napi::Error::New(env, e.what());
+        auto exception = error.Value();
+        exception["kind"] = "Unknown Error";
+        napi_throw(env, exception);
+    }
+    return env.Null();
+}
+
+// Async variants
+class cancelled_error : public std::runtime_error {
+    public:
+        cancelled_error(const std::string &what = "")
+            : std::runtime_error(what) {}
+};
+
+// Runs `Run()` on the libuv thread pool and settles a promise with the
+// result of `Resolve()` on the main thread. Rejections carry the same `kind`
+// as the errors thrown by the synchronous exports.
+//
+// The promise has a `cancel()` method: it cannot interrupt a report that is
+// already in flight, but workers check `CheckCancelled()` between steps and
+// reject with kind "Cancelled" without touching the keyboard any further.
+class PromiseWorker : public Napi::AsyncWorker {
+    public:
+        PromiseWorker(Napi::Env env)
+            : Napi::AsyncWorker(env),
+              deferred(Napi::Promise::Deferred::New(env)),
+              cancelled(std::make_shared< std::atomic< bool > >(false)) {}
+
+        Napi::Promise QueuePromise() {
+            auto promise = deferred.Promise();
+            auto cancelled = this->cancelled;
+            promise.Set(
+                "cancel",
+                Napi::Function::New(
+                    Env(),
+                    [cancelled](const Napi::CallbackInfo &info) {
+                        cancelled->store(true);
+                        return info.Env().Undefined();
+                    }
+                )
+            );
+            Queue();
+            return promise;
+        }
+    protected:
+        virtual void Run() = 0;
+        virtual Napi::Value Resolve(Napi::Env env) = 0;
+
+        void CheckCancelled() {
+            if (cancelled->load()) {
+                throw cancelled_error("The operation was cancelled.");
+            }
+        }
+
+        void Execute() override {
+            try {
+                CheckCancelled();
+                Run();
+            } catch (cancelled_error &e) {
+                failure = {"Cancelled", e.what()};
+            } catch (permissions_error &e) {
+                failure = {"Permissions Error", e.what()};
+            } catch (unsupported_keyboard &e) {
+                failure = {"Unsupported Keyboard", e.what()};
+            } catch (std::exception &e) {
+                failure = {"Unknown Error", e.what()};
+            }
+        }
+
+        void OnOK() override {
+            auto env = Env();
+            if (failure.has_value()) {
+                auto error = Napi::Error::New(env, failure->second);
+                auto exception = error.Value();
+                exception["kind"] = failure->first;
+                deferred.Reject(exception);
+                return;
+            }
+            deferred.Resolve(Resolve(env));
+        }
+    private:
+        Napi::Promise::Deferred deferred;
+        std::shared_ptr< std::atomic< bool > > cancelled;
+        std::optional< std::pair< std::string, std::string > > failure;
+};
+
+static Napi::Value
+diffsArray(Napi::Env env, const std::vector< NuPhy::KeymapDiff > &diffs) {
+    auto result = Napi::Array::New(env, diffs.size());
+    for (uint32_t i = 0; i < diffs.size(); i += 1) {
+        auto &diff = diffs[i];
+        auto indices = Napi::Array::New(env, diff.changedIndices.size());
+        for (uint32_t j = 0; j < diff.changedIndices.size(); j += 1) {
+            indices[j] = Napi::Number::New(env, double(diff.changedIndices[j]));
+        }
+        auto object = Napi::Object::New(env);
+        object["mac"] = Napi::Boolean::New(env, diff.mac);
+        object["written"] = Napi::Boolean::New(env, diff.written);
+        object["changedIndices"] = indices;
+        result[i] = object;
+    }
+    return result;
+}
+
+class GetKeyboardInfoWorker : public PromiseWorker {
+    public:
+        GetKeyboardInfoWorker(Napi::Env env) : PromiseWorker(env) {}
+    protected:
+        void Run() override { keyboard = getConnectedKeyboard(); }
+        Napi::Value Resolve(Napi::Env env) override {
+            return keyboardInfoObject(env, keyboard);
+        }
+    private:
+        std::shared_ptr< NuPhy > keyboard;
+};
+
+class ValidateYAMLWorker : public PromiseWorker {
+    public:
+        ValidateYAMLWorker(
+            Napi::Env env,
+            std::string keymapYAML,
+            std::optional< std::string > model
+        )
+            : PromiseWorker(env), keymapYAML(keymapYAML), model(model) {}
+    protected:
+        // Never opens a session, so needs no keyboard lock
+        void Run() override {
+            auto keyboard = getValidatingKeyboard(model);
+            CheckCancelled();
+            auto diagnostics = keyboard->diagnoseYAMLKeymap(keymapYAML, false);
+            throwFirstDiagnostic(diagnostics);
+        }
+        Napi::Value Resolve(Napi::Env env) override { return env.Null(); }
+    private:
+        std::string keymapYAML;
+        std::optional< std::string > model;
+};
+
+class SetKeymapFromYAMLWorker : public PromiseWorker {
+    public:
+        SetKeymapFromYAMLWorker(Napi::Env env, std::string keymapYAML)
+            : PromiseWorker(env), keymapYAML(keymapYAML) {}
+    protected:
+        void Run() override {
+            auto keyboard = getConnectedKeyboard();
+            if (keyboard == nullptr) {
+                throw std::runtime_error("The keyboard was unplugged.");
+            }
+            CheckCancelled();
+            auto profile = keyboard->compileYAMLKeymap(keymapYAML);
+            auto lock = lockKeyboard(keyboard);
+            CheckCancelled();
+            auto session = keyboard->openSession();
+            for (auto mac : {true, false}) {
+                CheckCancelled();
+                diffs.push_back(keyboard->applyKeymap(
+                    profile.getKeymap(mac),
+                    mac,
+                    session
+                ));
+            }
+        }
+        Napi::Value Resolve(Napi::Env env) override {
+            return diffsArray(env, diffs);
+        }
+    private:
+        std::string keymapYAML;
+        std::vector< NuPhy::KeymapDiff > diffs;
+};
+
+class SetKeymapFromBankWorker : public PromiseWorker {
+    public:
+        SetKeymapFromBankWorker(
+            Napi::Env env,
+            std::string bankPath,
+            std::string name
+        )
+            : PromiseWorker(env), bankPath(bankPath), name(name) {}
+    protected:
+        void Run() override {
+            auto keyboard = getConnectedKeyboard();
+            if (keyboard == nullptr) {
+                throw std::runtime_error("The keyboard was unplugged.");
+            }
+            auto bank = getBank(bankPath);
+            auto lock = lockKeyboard(keyboard);
+            CheckCancelled();
+            diffs = keyboard->setKeymapFromBank(*bank, name);
+        }
+        Napi::Value Resolve(Napi::Env env) override {
+            return diffsArray(env, diffs);
+        }
+    private:
+        std::string bankPath;
+        std::string name;
+        std::vector< NuPhy::KeymapDiff > diffs;
+};
+
+Napi::Value getKeyboardInfoAsync(const Napi::CallbackInfo &info) {
+    auto worker = new GetKeyboardInfoWorker(info.Env());
+    return worker->QueuePromise();
+}
+
+Napi::Value validateYAMLAsync(const Napi::CallbackInfo &info) {
+    Napi::Env env = info.Env();
+    if (info.Length() < 1 || !info[0].IsString()) {
+        Napi::TypeError::New(
+            env,
+            "Internal error: validateYAMLAsync takes a string argument and an optional model name"
+        )
+            .ThrowAsJavaScriptException();
+        return env.Null();
+    }
+
+    auto worker = new ValidateYAMLWorker(
+        env,
+        info[0].As< Napi::String >().Utf8Value(),
+        getOptionalString(info, 1)
+    );
+    return worker->QueuePromise();
+}
+
+Napi::Value setKeymapFromYAMLAsync(const Napi::CallbackInfo &info) {
+    Napi::Env env = info.Env();
+    if (info.Length() < 1 || !info[0].IsString()) {
+        Napi::TypeError::New(
+            env,
+            "Internal error: setKeymapFromYAMLAsync takes exactly one string argument"
+        )
+            .ThrowAsJavaScriptException();
+        return env.Null();
+    }
+
+    auto worker = new SetKeymapFromYAMLWorker(
+        env,
+        info[0].As< Napi::String >().Utf8Value()
+    );
+    return worker->QueuePromise();
+}
+
+Napi::Value setKeymapFromBankAsync(const Napi::CallbackInfo &info) {
+    Napi::Env env = info.Env();
+    if (info.Length() < 2 || !info[0].IsString() || !info[1].IsString()) {
+        Napi::TypeError::New(
+            env,
+            "Internal error: setKeymapFromBankAsync takes a bank path and a profile name"
+        )
+            .ThrowAsJavaScriptException();
+        return env.Null();
+    }
+
+    auto worker = new SetKeymapFromBankWorker(
+        env,
+        info[0].As< Napi::String >().Utf8Value(),
+        info[1].As< Napi::String >().Utf8Value()
+    );
+    return worker->QueuePromise();
+}
+
+// Hotplug
+struct HotplugSubscription {
+        Napi::ThreadSafeFunction callback;
+        std::unique_ptr< HotplugMonitor > monitor;
+};
+static std::unordered_map< uint32_t, std::unique_ptr< HotplugSubscription > >
+    hotplugSubscriptions;
+static uint32_t nextHotplugSubscription = 0;
+
+// subscribeHotplug((event: {type: "attach" | "detach", path}) => void)
+// Returns a function that ends the subscription.
+Napi::Value subscribeHotplug(const Napi::CallbackInfo &info) {
+    Napi::Env env = info.Env();
+    if (info.Length() < 1 || !info[0].IsFunction()) {
+        Napi::TypeError::New(
+            env,
+            "Internal error: subscribeHotplug takes exactly one function argument"
+        )
+            .ThrowAsJavaScriptException();
+        return env.Null();
+    }
+
+    watchDevices();
+    auto subscription = std::make_unique< HotplugSubscription >();
+    subscription->callback = Napi::ThreadSafeFunction::New(
+        env,
+        info[0].As< Napi::Function >(),
+        "nudelta-hotplug",
+        0,
+        1
+    );
+
+    auto callback = subscription->callback;
+    try {
+        subscription->monitor = std::make_unique< HotplugMonitor >(
+            [callback](const HotplugEvent &event) {
+                auto data = new HotplugEvent(event);
+                auto status = callback.NonBlockingCall(
+                    data,
+                    [](Napi::Env env,
+                       Napi::Function jsCallback,
+                       HotplugEvent *event) {
+                        if (env != nullptr && jsCallback != nullptr) {
+                            auto object = Napi::Object::New(env);
+                            object["type"] =
+                                event->attached ? "attach" : "detach";
+                            object["path"] = event->path;
+                            jsCallback.Call({object});
+                        }
+                        delete event;
+                    }
+                );
+                if (status != napi_ok) {
+                    delete data;
+                }
+            }
+        );
+    } catch (std::runtime_error &e) {
+        subscription->callback.Release();
+        Napi::Error::New(env, e.what()).ThrowAsJavaScriptException();
+        return env.Null();
+    }
+
+    auto id = nextHotplugSubscription++;
+    hotplugSubscriptions[id] = std::move(subscription);
+
+    return Napi::Function::New(env, [id](const Napi::CallbackInfo &info) {
+        auto it = hotplugSubscriptions.find(id);
+        if (it != hotplugSubscriptions.end()) {
+            // Joins the monitor thread, so nothing is queued after release
+            it->second->monitor = nullptr;
+            it->second->callback.Release();
+            hotplugSubscriptions.erase(it);
+        }
+        return info.Env().Undefined();
+    });
+}
+
+// Cumulative since the addon was loaded. Latencies are in microseconds;
+// percentiles are upper bounds accurate to a factor of 2.
+Napi::Value getStats(const Napi::CallbackInfo &info) {
+    Napi::Env env = info.Env();
+    auto stats = Stats::snapshot();
+
+    auto counters = Napi::Object::New(env);
+    for (auto &[name, value] : stats.counters) {
+        counters[name] = Napi::Number::New(env, double(value));
+    }
+
+    auto histograms = Napi::Object::New(env);
+    for (auto &[name, histogram] : stats.histograms) {
+        auto object = Napi::Object::New(env);
+        object["count"] = Napi::Number::New(env, double(histogram.count));
+        object["mean"] = Napi::Number::New(env, histogram.meanMicroseconds());
+        object["p50"] =
+            Napi::Number::New(env, histogram.percentileMicroseconds(50));
+        object["p99"] =
+            Napi::Number::New(env, histogram.percentileMicroseconds(99));
+        object["max"] =
+            Napi::Number::New(env, histogram.maxNanoseconds / 1000.0);
+        auto buckets = Napi::Array::New(env, histogram.buckets.size());
+        for (uint32_t i = 0; i < histogram.buckets.size(); i += 1) {
+            buckets[i] = Napi::Number::New(env, double(histogram.buckets[i]));
+        }
+        object["buckets"] = buckets;
+        histograms[name] = object;
+    }
+
+    auto object = Napi::Object::New(env);
+    object["counters"] = counters;
+    object["latencies"] = histograms;
+    return object;
+}
+
+// Joins every monitor thread, which may be enumerating devices, before the
+// process gets to hid_exit.
+static void stopHotplugMonitors(void *) {
+    // Each subscription's monitor is destroyed, and joined, before its
+    // callback
+    hotplugSubscriptions.clear();
+    DeviceRegistry::stopHotplug();
+}
+
 Napi::Object Init(Napi::Env env, Napi::Object exports) {
+    napi_add_env_cleanup_hook(env, stopHotplugMonitors, nullptr);
+
     exports.Set(
         Napi::String::New(env, "getKeyboardInfo"),
         Napi::Function::New(env, getKeyboardInfo)
@@ -138,10 +709,42 @@ Napi::Object Init(Napi::Env env, Napi::Object exports) {
         Napi::String::New(env, "validateYAML"),
         Napi::Function::New(env, validateYAML)
     );
+    exports.Set(
+        Napi::String::New(env, "createValidator"),
+        Napi::Function::New(env, createValidator)
+    );
     exports.Set(
         Napi::String::New(env, "setKeymapFromYAML"),
         Napi::Function::New(env, setKeymapFromYAML)
     );
+    exports.Set(
+        Napi::String::New(env, "setKeymapFromBank"),
+        Napi::Function::New(env, setKeymapFromBank)
+    );
+    exports.Set(
+        Napi::String::New(env, "getKeyboardInfoAsync"),
+        Napi::Function::New(env, getKeyboardInfoAsync)
+    );
+    exports.Set(
+        Napi::String::New(env, "validateYAMLAsync"),
+        Napi::Function::New(env, validateYAMLAsync)
+    );
+    exports.Set(
+        Napi::String::New(env, "setKeymapFromYAMLAsync"),
+        Napi::Function::New(env, setKeymapFromYAMLAsync)
+    );
+    exports.Set(
+        Napi::String::New(env, "setKeymapFromBankAsync"),
+        Napi::Function::New(env, setKeymapFromBankAsync)
+    );
+    exports.Set(
+        Napi::String::New(env, "subscribeHotplug"),
+        Napi::Function::New(env, subscribeHotplug)
+    );
+    exports.Set(
+        Napi::String::New(env, "getStats"),
+        Napi::Function::New(env, getStats)
+    );
     return exports;
 }
 
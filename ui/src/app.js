@@ -46,6 +46,7 @@ class Config {
         }
         redrawKeyboard();
         redrawOptions();
+        window.ipc.validateConfig(this.marshall());
     }
 
     unmarshall(config) {
@@ -92,6 +93,15 @@ window.lastKey = null;
 window.currentKey = null;
 window.clickCount = 0;
 window.config = new Config();
+window.diagnostics = [];
+
+function describeDiagnostics() {
+    if (window.diagnostics.length == 0) {
+        return "";
+    }
+    let { message, line } = window.diagnostics[0];
+    return line ? `Line ${line}: ${message}` : message;
+}
 
 function writeYAML() {
     let marshalled = window.config.marshall();
@@ -406,6 +416,12 @@ function redrawOptions() {
                             e.innerHTML = window.keyboardInfo.info;
                         })
                     );
+                    e.appendChild(
+                        n("p", (e) => {
+                            e.id = "diagnostics";
+                            e.textContent = describeDiagnostics();
+                        })
+                    );
                 })
             );
 
@@ -608,6 +624,14 @@ async function main() {
     });
     window.ipc.getKeyboardInfo();
 
+    window.ipc.onValidateConfig((_, { diagnostics }) => {
+        window.diagnostics = diagnostics;
+        let e = g("#diagnostics");
+        if (e !== null) {
+            e.textContent = describeDiagnostics();
+        }
+    });
+
     window.ipc.onLoadConfig((_, { config }) => {
         window.config.unmarshall(config);
     });
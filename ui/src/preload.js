@@ -24,6 +24,9 @@ contextBridge.exposeInMainWorld("ipc", {
     onGetKeyboardInfo: (callback) =>
         ipcRenderer.on("get-keyboard-info-reply", callback),
     sendConfig: (remap) => ipcRenderer.send("write-yaml", remap),
+    validateConfig: (remap) => ipcRenderer.send("validate-config", remap),
+    onValidateConfig: (callback) =>
+        ipcRenderer.on("validate-config-reply", callback),
     getVersion: () => ipcRenderer.send("get-version"),
     onGetVersion: (callback) => ipcRenderer.on("get-version-reply", callback),
 });
@@ -7,35 +7,124 @@ import fg from "fast-glob";
 const argv = process.argv.slice(2);
 const print = console.log;
 
-let resourceDir = argv[0];
+// With --no-models, only the tables shared by every model are emitted and
+// models are left to model packs (see util/res_to_pack.js).
+let builtInModels = !argv.includes("--no-models");
+let resourceDir = argv.filter((arg) => !arg.startsWith("--"))[0];
 let globStr = [resourceDir, "**", "*.yml"].join("/");
-let files = fg.sync(globStr, { absolute: true });
+let files = fg.sync(globStr, { absolute: true }).sort();
+
+// Everything is emitted as constant arrays so no table is built at runtime:
+// dicts are sorted by key so NameTable can binary search them.
+function compareKeys(a, b) {
+    return Buffer.compare(Buffer.from(a), Buffer.from(b));
+}
+
+function printBytes(arrayName, bytes) {
+    let hex = bytes.map((byte) => `0x${byte.toString(16).padStart(2, "0")}`);
+    print(
+        `static constexpr std::uint8_t ${arrayName}[] = {${hex.join(", ")}};`
+    );
+}
+
+// Directories with a model.yml describe a keyboard model: their tables are
+// only referenced by its ModelDescriptor. The others hold tables shared by
+// every model, which are static members of the NuPhy class.
+let models = {};
+for (let file of files) {
+    let keyboard = path.basename(path.dirname(file));
+    let str = fs.readFileSync(file, { encoding: "utf8" });
+    let [_, type] = str.split("\n")[0].split(" ");
+    if (type == "model") {
+        models[keyboard] = { name: keyboard, ...yaml.parse(str), lengths: {} };
+    }
+}
 
 print('#include "common.hpp"');
+print('#include "model.hpp"');
 print('#include "nuphy.hpp"');
 for (let file of files) {
     let directory = path.dirname(file);
     let keyboard = path.basename(directory);
+    let model = models[keyboard];
+    if (model !== undefined && !builtInModels) {
+        continue;
+    }
 
     let str = fs.readFileSync(file, { encoding: "utf8" });
     print(`// ${file}`);
     let object = yaml.parse(str);
     let lines = str.split("\n");
     let [_, type, name] = lines[0].split(" ");
+    let arrayName = `${keyboard}_${name}`;
     if (type == "list") {
-        print(`const std::vector<std::uint32_t> ${keyboard}::${name} = {`);
+        print(`static constexpr std::uint32_t ${arrayName}[] = {`);
         for (let integer of object) {
             print(`    0x${integer.toString(16)},`);
         }
         print("};");
+        if (model !== undefined) {
+            model.lengths[name] = object.length;
+        } else {
+            print(
+                `const Span<std::uint32_t> ${keyboard}::${name} = ${arrayName};`
+            );
+        }
     } else if (type == "dict") {
-        print(
-            `const std::unordered_map<std::string, std::uint32_t> ${keyboard}::${name} = {`
-        );
-        for (let key in object) {
+        print(`static constexpr NameTable::Entry ${arrayName}[] = {`);
+        for (let key of Object.keys(object).sort(compareKeys)) {
             let integer = object[key];
-            print(`    { "${key}", 0x${integer.toString(16)} },`);
+            print(`    { ${JSON.stringify(key)}, 0x${integer.toString(16)} },`);
         }
         print("};");
+        if (model === undefined) {
+            print(`const NameTable ${keyboard}::${name} = ${arrayName};`);
+        }
+    } else if (type == "model") {
+        for (let mode of ["Win", "Mac"]) {
+            let headers = object[mode.toLowerCase()];
+            for (let header of ["getKeymapHeader", "setKeymapHeader"]) {
+                printBytes(`${keyboard}_${header}${mode}`, headers[header]);
+            }
+        }
+    }
+}
+
+if (!builtInModels || Object.keys(models).length == 0) {
+    print("const Span<ModelDescriptor> ModelDescriptor::builtIn;");
+    process.exit(0);
+}
+// constexpr, so that the table is constant-initialized rather than filled in
+// at startup. builtIn itself is only declared const, as ModelDescriptor is
+// incomplete in its own class; its initializer is still a constant.
+print("static constexpr ModelDescriptor builtInModels[] = {");
+for (let model of Object.values(models)) {
+    let keymapSize = model.lengths.defaultKeymapWin;
+    if (
+        keymapSize === undefined ||
+        model.lengths.defaultKeymapMac !== keymapSize
+    ) {
+        throw new Error(
+            `${model.name}: both default keymaps must exist and match in size.`
+        );
+    }
+    print("    {");
+    print(`        ${JSON.stringify(model.name)},`);
+    print(`        ${JSON.stringify(model.productString)},`);
+    print(`        ${keymapSize},`);
+    for (let mode of ["Win", "Mac"]) {
+        print("        {");
+        for (let table of [
+            "getKeymapHeader",
+            "setKeymapHeader",
+            "defaultKeymap",
+            "indicesByKeyName",
+        ]) {
+            print(`            ${model.name}_${table}${mode},`);
+        }
+        print("        },");
     }
+    print("    },");
 }
+print("};");
+print("const Span<ModelDescriptor> ModelDescriptor::builtIn = builtInModels;");
@@ -0,0 +1,121 @@
+"use strict";
+import fs from "fs-extra";
+import path from "path";
+import yaml from "yaml";
+
+// Writes a model's resources, i.e. a directory under res/ with a model.yml,
+// to a model pack. See include/modelpack.hpp for the layout.
+const argv = process.argv.slice(2);
+if (argv.length != 2) {
+    console.error("Usage: node res_to_pack.js <model directory> <output>");
+    process.exit(64);
+}
+let [modelDir, output] = argv;
+
+const VERSION = 1;
+const HEADER_SIZE = 64;
+const MODE_SIZE = 32;
+const INDEX_ENTRY_SIZE = 12;
+const MAX_MODEL_SIZE = 16;
+
+function compareKeys(a, b) {
+    return Buffer.compare(Buffer.from(a), Buffer.from(b));
+}
+
+function fnv1a64(bytes, hash = 0xcbf29ce484222325n) {
+    for (let byte of bytes) {
+        hash ^= BigInt(byte);
+        hash = (hash * 0x100000001b3n) & 0xffffffffffffffffn;
+    }
+    return hash;
+}
+
+let name = path.basename(path.resolve(modelDir));
+let model = null;
+let tables = {};
+let files = fs.readdirSync(modelDir).filter((file) => file.endsWith(".yml"));
+for (let file of files.sort()) {
+    let str = fs.readFileSync(path.join(modelDir, file), { encoding: "utf8" });
+    let [_, type, tableName] = str.split("\n")[0].split(" ");
+    if (type == "model") {
+        model = yaml.parse(str);
+    } else if (type == "list" || type == "dict") {
+        tables[tableName] = yaml.parse(str);
+    }
+}
+if (model === null) {
+    throw new Error(`${modelDir} holds no model.yml.`);
+}
+if (Buffer.byteLength(name) > MAX_MODEL_SIZE) {
+    throw new Error(`Model name '${name}' is too long.`);
+}
+
+let chunks = [];
+let size = HEADER_SIZE;
+// Appends `buffer`, padded so whatever follows is 8-byte aligned, and
+// returns the offset it will be stored at.
+function append(buffer) {
+    let offset = size;
+    let padding = (8 - (buffer.length % 8)) % 8;
+    chunks.push(buffer, Buffer.alloc(padding));
+    size += buffer.length + padding;
+    return offset;
+}
+
+let header = Buffer.alloc(HEADER_SIZE);
+header.write("NDMP", 0, "latin1");
+header.writeUInt32LE(VERSION, 4);
+header.writeUInt32LE(HEADER_SIZE, 8);
+header.write(name, 16, "utf8");
+
+let productString = Buffer.from(model.productString, "utf8");
+header.writeUInt32LE(append(productString), 32);
+header.writeUInt32LE(productString.length, 36);
+
+let keymapSize = null;
+for (let [i, mode] of ["Win", "Mac"].entries()) {
+    let headers = model[mode.toLowerCase()];
+    let defaultKeymap = tables[`defaultKeymap${mode}`];
+    let indices = tables[`indicesByKeyName${mode}`];
+    if (defaultKeymap === undefined || indices === undefined) {
+        throw new Error(`${modelDir} lacks the ${mode} mode's tables.`);
+    }
+    if (keymapSize !== null && defaultKeymap.length != keymapSize) {
+        throw new Error(`${name}: both default keymaps must match in size.`);
+    }
+    keymapSize = defaultKeymap.length;
+
+    let modeBuffer = Buffer.alloc(MODE_SIZE);
+    for (let [j, reportHeader] of [
+        headers.getKeymapHeader,
+        headers.setKeymapHeader,
+    ].entries()) {
+        modeBuffer.writeUInt32LE(append(Buffer.from(reportHeader)), j * 8);
+        modeBuffer.writeUInt32LE(reportHeader.length, j * 8 + 4);
+    }
+
+    let keymap = Buffer.alloc(keymapSize * 4);
+    defaultKeymap.forEach((word, j) => keymap.writeUInt32LE(word, j * 4));
+    modeBuffer.writeUInt32LE(append(keymap), 16);
+
+    let keys = Object.keys(indices).sort(compareKeys);
+    let entries = Buffer.alloc(keys.length * INDEX_ENTRY_SIZE);
+    keys.forEach((key, j) => {
+        let keyName = Buffer.from(key, "utf8");
+        let entry = j * INDEX_ENTRY_SIZE;
+        entries.writeUInt32LE(append(keyName), entry);
+        entries.writeUInt32LE(keyName.length, entry + 4);
+        entries.writeUInt32LE(indices[key], entry + 8);
+    });
+    modeBuffer.writeUInt32LE(append(entries), 20);
+    modeBuffer.writeUInt32LE(keys.length, 24);
+
+    header.writeUInt32LE(append(modeBuffer), 40 + i * 4);
+}
+header.writeUInt32LE(keymapSize, 12);
+
+let body = Buffer.concat(chunks);
+let checksum = fnv1a64(body, fnv1a64(header.subarray(0, 48)));
+header.writeBigUInt64LE(checksum, 48);
+
+fs.writeFileSync(output, Buffer.concat([header, body]));